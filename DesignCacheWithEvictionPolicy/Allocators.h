@@ -0,0 +1,153 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Fixed-capacity node pool. Blocks of each size are carved from slabs holding `capacity`
+// blocks, and freed blocks go back on a per-size free list, so once a container has reached
+// its steady-state size, inserting and erasing nodes never touches the heap.
+class NodePool{
+private:
+    struct SizeClass{
+        size_t blockSize;
+        void* freeList = nullptr;
+    };
+
+    vector<SizeClass> classes;
+    vector<void*> slabs;
+    size_t blocksPerSlab;
+    size_t heapAllocations = 0;
+
+    static size_t roundUp(size_t bytes){
+        const size_t align = alignof(max_align_t);
+        return (max(bytes, sizeof(void*)) + align - 1) / align * align;
+    }
+
+    void refill(SizeClass& sizeClass){
+        char* slab = static_cast<char*>(::operator new(sizeClass.blockSize * blocksPerSlab));
+        heapAllocations++;
+        slabs.push_back(slab);
+        for( size_t i = blocksPerSlab; i-- > 0; ){
+            void* block = slab + i * sizeClass.blockSize;
+            *static_cast<void**>(block) = sizeClass.freeList;
+            sizeClass.freeList = block;
+        }
+    }
+
+    SizeClass& classFor(size_t bytes){
+        size_t blockSize = roundUp(bytes);
+        for( SizeClass& sizeClass : classes ){
+            if( sizeClass.blockSize == blockSize ){
+                return sizeClass;
+            }
+        }
+        classes.push_back({blockSize});
+        return classes.back();
+    }
+
+public:
+    // One slab per block size covers a container of `capacity` entries, plus one spare
+    // for caches that insert before they evict
+    NodePool(size_t capacity) : blocksPerSlab(max<size_t>(capacity, 1) + 1){}
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool(){
+        for( void* slab : slabs ){
+            ::operator delete(slab);
+        }
+    }
+
+    void* allocate(size_t bytes){
+        SizeClass& sizeClass = classFor(bytes);
+        if( !sizeClass.freeList ){
+            refill(sizeClass);
+        }
+        void* block = sizeClass.freeList;
+        sizeClass.freeList = *static_cast<void**>(block);
+        return block;
+    }
+
+    void deallocate(void* block, size_t bytes){
+        SizeClass& sizeClass = classFor(bytes);
+        *static_cast<void**>(block) = sizeClass.freeList;
+        sizeClass.freeList = block;
+    }
+
+    // Arrays (such as hash bucket tables) are not pooled but are counted with the slabs
+    void* allocateArray(size_t bytes){
+        heapAllocations++;
+        return ::operator new(bytes);
+    }
+
+    size_t heapAllocationCount() const{
+        return heapAllocations;
+    }
+};
+
+// Allocator for node-based containers: single objects come from a shared NodePool
+template<typename T>
+class PoolAllocator{
+public:
+    using value_type = T;
+
+    shared_ptr<NodePool> pool;
+
+    PoolAllocator(shared_ptr<NodePool> _pool) : pool(move(_pool)){}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool){}
+
+    T* allocate(size_t n){
+        static_assert(alignof(T) <= alignof(max_align_t), "NodePool only guarantees fundamental alignment");
+        if( n == 1 ){
+            return static_cast<T*>(pool->allocate(sizeof(T)));
+        }
+        return static_cast<T*>(pool->allocateArray(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n){
+        if( n == 1 ){
+            pool->deallocate(p, sizeof(T));
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>& other) const{
+        return pool == other.pool;
+    }
+};
+
+// std::allocator that counts every allocation, to measure what a container asks of the heap
+template<typename T>
+class CountingAllocator{
+public:
+    using value_type = T;
+
+    shared_ptr<size_t> count;
+
+    CountingAllocator(shared_ptr<size_t> _count) : count(move(_count)){}
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : count(other.count){}
+
+    T* allocate(size_t n){
+        ++*count;
+        return allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n){
+        allocator<T>().deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const CountingAllocator<U>& other) const{
+        return count == other.count;
+    }
+};
@@ -0,0 +1,1206 @@
+#include "Cache.h"
+#include "Compression.h"
+#include "Options.h"
+#include "Resp.h"
+#include "Trace.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+size_t peakRssKb(){
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);
+}
+
+vector<uint64_t> buildTrace(const Options& options){
+    string kind = options.get("trace", "zipf");
+    size_t keys = options.getSize("keys", 100000);
+    size_t ops = options.getSize("ops", 1000000);
+    double skew = options.getDouble("skew", 0.99);
+    uint64_t seed = options.getSize("seed", 1);
+    if( kind == "zipf" ) return zipfTrace(keys, ops, skew, seed);
+    if( kind == "scan" ) return scanTrace(ops);
+    if( kind == "loop" ) return loopTrace(keys, ops);
+    if( kind == "mixed" ) return mixedTrace(keys, ops, skew, seed);
+    return loadTrace(kind);
+}
+
+unique_ptr<IEvictionPolicy<uint64_t>> makePolicy(const string& name, size_t capacity){
+    return makeEvictionPolicy<uint64_t>(name, capacity);
+}
+
+unique_ptr<IStorage<uint64_t, uint64_t>> makeStorage(const string& name, size_t capacity, milliseconds ttl){
+    if( name == "hash" ) return make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity);
+    if( name == "flat" ) return make_unique<FlatHashMapStorage<uint64_t, uint64_t>>(capacity);
+    if( name == "ttl" ) return make_unique<TTLHashMapStorage<uint64_t, uint64_t>>(ttl);
+    throw invalid_argument("Unknown storage " + name);
+}
+
+// "lru-engine" selects the fused LRUCacheEngine, which replaces both storage and policy
+unique_ptr<Cache<uint64_t, uint64_t>> makeCache(const string& policy, const string& storage, size_t capacity, milliseconds ttl){
+    if( policy == "lru-engine" ){
+        return make_unique<Cache<uint64_t, uint64_t>>(make_unique<LRUCacheEngine<uint64_t, uint64_t>>(capacity), capacity);
+    }
+    return make_unique<Cache<uint64_t, uint64_t>>(makeStorage(storage, capacity, ttl), makePolicy(policy, capacity), capacity);
+}
+
+double percentile(vector<uint32_t>& samples, double fraction){
+    if( samples.empty() ) return 0;
+    size_t rank = min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+// Replays the trace as a look-aside cache: every miss is followed by a put of the key.
+// Latency covers the lookup and, on a miss, the put.
+int runTraceBenchmark(const Options& options){
+    vector<uint64_t> trace = buildTrace(options);
+    size_t capacity = options.getSize("capacity", 10000);
+    string storage = options.get("storage", "hash");
+    milliseconds ttl(options.getSize("ttl-ms", 60000));
+    string traceName = options.get("trace", "zipf");
+
+    if( options.get("header", "yes") == "yes" ){
+        cout << "policy,storage,trace,capacity,ops,hit_ratio,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb" << endl;
+    }
+    for( const string& policy : splitList(options.get("policy", "lru")) ){
+        auto cache = makeCache(policy, storage, capacity, ttl);
+        vector<uint32_t> latencies(trace.size());
+        size_t hits = 0;
+        auto start = steady_clock::now();
+        for( size_t i = 0; i < trace.size(); i++ ){
+            auto opStart = steady_clock::now();
+            uint64_t key = trace[i];
+            if( cache->getPtr(key) ){
+                hits++;
+            } else {
+                cache->put(key, key);
+            }
+            latencies[i] = static_cast<uint32_t>(min<int64_t>(duration_cast<nanoseconds>(steady_clock::now() - opStart).count(), UINT32_MAX));
+        }
+        double seconds = duration<double>(steady_clock::now() - start).count();
+
+        cout << policy << "," << (policy == "lru-engine" ? "engine" : storage) << "," << traceName << "," << capacity << "," << trace.size() << ","
+             << fixed << setprecision(4) << static_cast<double>(hits) / max<size_t>(trace.size(), 1) << ","
+             << setprecision(0) << trace.size() / seconds << ","
+             << percentile(latencies, 0.50) << "," << percentile(latencies, 0.99) << "," << percentile(latencies, 0.999) << ","
+             << peakRssKb() << endl;
+    }
+    return 0;
+}
+
+// Per-op latency of the same cache built through the runtime interfaces (Cache) and
+// composed at compile time (StaticCache). The trace is replayed look-aside, as in trace mode.
+template<typename CacheType>
+pair<double, double> measureStaticVsDynamic(CacheType& cache, const vector<uint64_t>& trace, size_t rounds){
+    size_t hits = 0;
+    auto start = steady_clock::now();
+    for( size_t round = 0; round < rounds; round++ ){
+        for( uint64_t key : trace ){
+            if( cache.getPtr(key) ){
+                hits++;
+            } else {
+                cache.put(key, key);
+            }
+        }
+    }
+    double ops = static_cast<double>(trace.size() * rounds);
+    return {duration<double, nano>(steady_clock::now() - start).count() / ops, hits / ops};
+}
+
+int runStaticBenchmark(const Options& options){
+    vector<uint64_t> trace = buildTrace(options);
+    size_t capacity = options.getSize("capacity", 10000);
+    size_t rounds = options.getSize("rounds", 3);
+
+    using StaticLRU = StaticCache<uint64_t, uint64_t, HashMapStorage<uint64_t, uint64_t>, LRUEvictionPolicy<uint64_t>>;
+    using StaticEngine = StaticCache<uint64_t, uint64_t, LRUCacheEngine<uint64_t, uint64_t>>;
+
+    cout << "cache,composition,ns_per_op,hit_ratio" << endl;
+    auto report = [&](const string& name, const string& composition, pair<double, double> result){
+        cout << name << "," << composition << "," << fixed << setprecision(1) << result.first << "," << setprecision(4) << result.second << endl;
+    };
+    {
+        Cache<uint64_t, uint64_t> cache(make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity), make_unique<LRUEvictionPolicy<uint64_t>>(capacity), capacity);
+        report("hash+lru", "runtime", measureStaticVsDynamic(cache, trace, rounds));
+    }
+    {
+        StaticLRU cache(capacity, HashMapStorage<uint64_t, uint64_t>(capacity), LRUEvictionPolicy<uint64_t>(capacity));
+        report("hash+lru", "static", measureStaticVsDynamic(cache, trace, rounds));
+    }
+    {
+        Cache<uint64_t, uint64_t> cache(make_unique<LRUCacheEngine<uint64_t, uint64_t>>(capacity), capacity);
+        report("lru-engine", "runtime", measureStaticVsDynamic(cache, trace, rounds));
+    }
+    {
+        StaticEngine cache(capacity, LRUCacheEngine<uint64_t, uint64_t>(capacity));
+        report("lru-engine", "static", measureStaticVsDynamic(cache, trace, rounds));
+    }
+    return 0;
+}
+
+// Per-key cost of batched multiGet / multiPut against a loop of single-key calls on a
+// ShardedCache holding --keys entries, so most bucket accesses miss the CPU caches
+int runMultiGetBenchmark(const Options& options){
+    size_t keyCount = options.getSize("keys", 1000000);
+    size_t shardCount = options.getSize("shards", 16);
+    size_t lookups = options.getSize("ops", 2000000);
+    string policy = options.get("policy", "lru");
+    uint64_t seed = options.getSize("seed", 1);
+
+    ShardedCache<uint64_t, uint64_t> cache(shardCount, keyCount + keyCount / 4,
+        [&]{ return make_unique<HashMapStorage<uint64_t, uint64_t>>((keyCount + keyCount / 4) / shardCount + 1); },
+        [&]{ return makePolicy(policy, (keyCount + keyCount / 4) / shardCount + 1); });
+
+    mt19937_64 rng(seed);
+    uniform_int_distribution<uint64_t> pick(0, keyCount - 1);
+    vector<pair<uint64_t, uint64_t>> entries(keyCount);
+    for( uint64_t i = 0; i < keyCount; i++ ){
+        entries[i] = {i * 0x9E3779B97F4A7C15ULL, i};
+    }
+
+    cout << "batch,op,loop_ns_per_key,batched_ns_per_key,speedup" << endl;
+    for( const string& batchText : splitList(options.get("batch", "50,500")) ){
+        size_t batch = stoull(batchText);
+        size_t rounds = max<size_t>(lookups / batch, 1);
+        vector<vector<uint64_t>> keyBatches(rounds, vector<uint64_t>(batch));
+        vector<vector<pair<uint64_t, uint64_t>>> putBatches(rounds, vector<pair<uint64_t, uint64_t>>(batch));
+        for( size_t r = 0; r < rounds; r++ ){
+            for( size_t i = 0; i < batch; i++ ){
+                keyBatches[r][i] = entries[pick(rng)].first;
+                putBatches[r][i] = entries[pick(rng)];
+            }
+        }
+        double perKey = static_cast<double>(rounds * batch);
+        auto nsPerKey = [&](auto body){
+            auto start = steady_clock::now();
+            body();
+            return duration<double, nano>(steady_clock::now() - start).count() / perKey;
+        };
+
+        double loopPut = nsPerKey([&]{
+            for( auto& entriesOfBatch : putBatches ){
+                for( auto& [key, val] : entriesOfBatch ) cache.put(key, val);
+            }
+        });
+        double batchedPut = nsPerKey([&]{
+            for( auto& entriesOfBatch : putBatches ) cache.multiPut(entriesOfBatch);
+        });
+        // Make every lookup a hit
+        for( size_t start = 0; start < keyCount; start += 4096 ){
+            cache.multiPut(span<const pair<uint64_t, uint64_t>>(entries).subspan(start, min<size_t>(4096, keyCount - start)));
+        }
+
+        size_t found = 0;
+        double loopGet = nsPerKey([&]{
+            for( auto& keys : keyBatches ){
+                for( uint64_t key : keys ) found += cache.tryGet(key).has_value();
+            }
+        });
+        double batchedGet = nsPerKey([&]{
+            for( auto& keys : keyBatches ){
+                for( auto& result : cache.multiGet(keys) ) found += result.has_value();
+            }
+        });
+        if( found != 2 * rounds * batch ){
+            throw runtime_error("multiget benchmark: unexpected misses");
+        }
+
+        cout << fixed << setprecision(1)
+             << batch << ",get," << loopGet << "," << batchedGet << "," << setprecision(2) << loopGet / batchedGet << endl
+             << setprecision(1)
+             << batch << ",put," << loopPut << "," << batchedPut << "," << setprecision(2) << loopPut / batchedPut << endl;
+    }
+    return 0;
+}
+
+// Insert / lookup / erase cost of one storage filled with keyCount random keys
+template<typename Storage>
+void measureStorage(const string& name, const vector<uint64_t>& keys, const vector<uint64_t>& probes, const vector<uint64_t>& absent){
+    Storage storage;
+    auto nsPerOp = [](size_t ops, auto body){
+        auto start = steady_clock::now();
+        body();
+        return duration<double, nano>(steady_clock::now() - start).count() / max<size_t>(ops, 1);
+    };
+    double insert = nsPerOp(keys.size(), [&]{
+        for( uint64_t key : keys ) storage.add(key, key);
+    });
+    size_t found = 0;
+    double hit = nsPerOp(probes.size(), [&]{
+        for( uint64_t key : probes ) found += storage.find(key) != nullptr;
+    });
+    double miss = nsPerOp(absent.size(), [&]{
+        for( uint64_t key : absent ) found += storage.find(key) != nullptr;
+    });
+    if( found != probes.size() ){
+        throw runtime_error(name + ": lookups disagree with inserted keys");
+    }
+    double erase = nsPerOp(keys.size(), [&]{
+        for( uint64_t key : keys ) storage.remove(key);
+    });
+    cout << name << "," << keys.size() << "," << fixed << setprecision(1) << insert << "," << hit << "," << miss << "," << erase << endl;
+}
+
+int runFlatStorageBenchmark(const Options& options){
+    size_t lookups = options.getSize("ops", 10000000);
+    uint64_t seed = options.getSize("seed", 1);
+    cout << "storage,keys,insert_ns,lookup_hit_ns,lookup_miss_ns,erase_ns" << endl;
+    for( const string& keysText : splitList(options.get("keys", "1000000,50000000")) ){
+        size_t keyCount = stoull(keysText);
+        mt19937_64 rng(seed);
+        // Odd keys are inserted and even keys never are, so misses are guaranteed
+        vector<uint64_t> keys(keyCount), probes(min(lookups, keyCount)), absent(min(lookups, keyCount));
+        for( uint64_t& key : keys ) key = rng() | 1;
+        uniform_int_distribution<size_t> pick(0, keyCount - 1);
+        for( uint64_t& key : probes ) key = keys[pick(rng)];
+        for( uint64_t& key : absent ) key = rng() & ~1ULL;
+
+        measureStorage<HashMapStorage<uint64_t, uint64_t>>("hash", keys, probes, absent);
+        measureStorage<FlatHashMapStorage<uint64_t, uint64_t>>("flat", keys, probes, absent);
+    }
+    return 0;
+}
+
+// Throughput of a read-mostly workload (--write-pct puts per 100 ops, and a put after every
+// miss) replayed by 1 to 64 threads, each from its own offset of one Zipf trace
+template<typename CacheType>
+pair<double, double> measureConcurrent(CacheType& cache, const vector<uint64_t>& trace, size_t threadCount, size_t opsPerThread, size_t writePercent){
+    atomic<size_t> hits{0};
+    vector<thread> threads;
+    auto start = steady_clock::now();
+    for( size_t t = 0; t < threadCount; t++ ){
+        threads.emplace_back([&, t]{
+            size_t localHits = 0;
+            size_t offset = t * trace.size() / threadCount;
+            for( size_t i = 0; i < opsPerThread; i++ ){
+                uint64_t key = trace[(offset + i) % trace.size()];
+                if( i % 100 < writePercent ){
+                    cache.put(key, key);
+                } else if( cache.tryGet(key) ){
+                    localHits++;
+                } else {
+                    cache.put(key, key);
+                }
+            }
+            hits += localHits;
+        });
+    }
+    for( thread& t : threads ){
+        t.join();
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    double ops = static_cast<double>(threadCount * opsPerThread);
+    return {ops / seconds, hits / ops};
+}
+
+int runConcurrentBenchmark(const Options& options){
+    vector<uint64_t> trace = buildTrace(options);
+    size_t capacity = options.getSize("capacity", 50000);
+    size_t shardCount = options.getSize("shards", 16);
+    size_t opsPerThread = options.getSize("thread-ops", 1000000);
+    size_t writePercent = options.getSize("write-pct", 1);
+
+    cout << "cache,threads,ops_per_sec,hit_ratio" << endl;
+    for( const string& threadsText : splitList(options.get("threads", "1,2,4,8,16,32,64")) ){
+        size_t threadCount = stoull(threadsText);
+        auto report = [&](const string& name, pair<double, double> result){
+            cout << name << "," << threadCount << "," << fixed << setprecision(0) << result.first << "," << setprecision(4) << result.second << endl;
+        };
+        for( const string policy : {"lru", "clock"} ){
+            ShardedCache<uint64_t, uint64_t> cache(shardCount, capacity,
+                [&]{ return make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity / shardCount + 1); },
+                [&]{ return makePolicy(policy, capacity / shardCount + 1); });
+            report("sharded-" + policy, measureConcurrent(cache, trace, threadCount, opsPerThread, writePercent));
+        }
+        ConcurrentCache<uint64_t, uint64_t> cache(shardCount, capacity);
+        report("concurrent", measureConcurrent(cache, trace, threadCount, opsPerThread, writePercent));
+    }
+    return 0;
+}
+
+// A TieredCache (per-thread L1 of --l1 entries) over ShardedCache and ConcurrentCache against
+// the bare ShardedCache, on the same read-mostly workload as concurrent mode
+int runTieredBenchmark(const Options& options){
+    vector<uint64_t> trace = buildTrace(options);
+    size_t capacity = options.getSize("capacity", 50000);
+    size_t shardCount = options.getSize("shards", 16);
+    size_t opsPerThread = options.getSize("thread-ops", 1000000);
+    size_t writePercent = options.getSize("write-pct", 1);
+    size_t l1Entries = options.getSize("l1", 256);
+    size_t revalidateAfter = options.getSize("revalidate", 1);
+
+    auto makeSharded = [&]{
+        return make_unique<ShardedCache<uint64_t, uint64_t>>(shardCount, capacity,
+            [&]{ return make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity / shardCount + 1); },
+            [&]{ return make_unique<ClockEvictionPolicy<uint64_t>>(capacity / shardCount + 1); });
+    };
+
+    cout << "cache,threads,ops_per_sec,l1_hit_ratio,l2_hit_ratio" << endl;
+    for( const string& threadsText : splitList(options.get("threads", "1,2,4,8,16,32,64")) ){
+        size_t threadCount = stoull(threadsText);
+        auto report = [&](const string& name, double opsPerSec, double l1Ratio, double l2Ratio){
+            cout << name << "," << threadCount << "," << fixed << setprecision(0) << opsPerSec << "," << setprecision(4) << l1Ratio << "," << l2Ratio << endl;
+        };
+        {
+            auto cache = makeSharded();
+            auto [opsPerSec, hitRatio] = measureConcurrent(*cache, trace, threadCount, opsPerThread, writePercent);
+            report("sharded-clock", opsPerSec, 0, hitRatio);
+        }
+        {
+            TieredCache<uint64_t, uint64_t> cache(makeSharded(), l1Entries, revalidateAfter);
+            double opsPerSec = measureConcurrent(cache, trace, threadCount, opsPerThread, writePercent).first;
+            report("tiered+sharded-clock", opsPerSec, cache.stats().l1HitRatio(), cache.stats().l2HitRatio());
+        }
+        {
+            TieredCache<uint64_t, uint64_t, ConcurrentCache<uint64_t, uint64_t>> cache(make_unique<ConcurrentCache<uint64_t, uint64_t>>(shardCount, capacity), l1Entries, revalidateAfter);
+            double opsPerSec = measureConcurrent(cache, trace, threadCount, opsPerThread, writePercent).first;
+            report("tiered+concurrent", opsPerSec, cache.stats().l1HitRatio(), cache.stats().l2HitRatio());
+        }
+    }
+    return 0;
+}
+
+// String-key lookups three ways: building a std::string from the caller's buffer, passing the
+// buffer as a HashedKey (hashed once per call), and passing a HashedKey whose hash the caller
+// already had. The trace is replayed look-aside; misses put a new string in every variant.
+template<typename Lookup, typename Put>
+pair<double, double> measureLookups(const vector<string_view>& trace, const vector<size_t>& hashes, const string& variant, size_t rounds, Lookup lookup, Put put){
+    size_t hits = 0;
+    bool copies = variant == "string", hashesPerCall = variant == "view";
+    auto start = steady_clock::now();
+    for( size_t round = 0; round < rounds; round++ ){
+        for( size_t i = 0; i < trace.size(); i++ ){
+            bool hit;
+            if( copies ){
+                hit = lookup(string(trace[i]));
+            } else if( hashesPerCall ){
+                hit = lookup(HashedKey<string>(trace[i]));
+            } else {
+                hit = lookup(HashedKey<string>(trace[i], hashes[i]));
+            }
+            if( hit ){
+                hits++;
+            } else {
+                put(string(trace[i]));
+            }
+        }
+    }
+    double ops = static_cast<double>(trace.size() * rounds);
+    return {duration<double, nano>(steady_clock::now() - start).count() / ops, hits / ops};
+}
+
+int runLookupBenchmark(const Options& options){
+    vector<uint64_t> ids = buildTrace(options);
+    size_t capacity = options.getSize("capacity", 50000);
+    size_t keyBytes = options.getSize("key-bytes", 40);
+    size_t rounds = options.getSize("rounds", 3);
+    size_t shardCount = options.getSize("shards", 16);
+
+    // The caller's request buffer: keys padded to keyBytes, looked up through views into it
+    unordered_map<uint64_t, string> names;
+    for( uint64_t id : ids ){
+        string& name = names[id];
+        if( name.empty() ){
+            name = "key:" + to_string(id);
+            name.resize(max(keyBytes, name.size()), '-');
+        }
+    }
+    vector<string_view> trace;
+    vector<size_t> hashes;
+    for( uint64_t id : ids ){
+        trace.push_back(names[id]);
+        hashes.push_back(hash<string_view>()(trace.back()));
+    }
+
+    cout << "cache,variant,ns_per_op,hit_ratio" << endl;
+    for( const string variant : {"string", "view", "prehashed"} ){
+        auto report = [&](const string& name, pair<double, double> result){
+            cout << name << "," << variant << "," << fixed << setprecision(1) << result.first << "," << setprecision(4) << result.second << endl;
+        };
+        {
+            Cache<string, uint64_t> cache(make_unique<HashMapStorage<string, uint64_t>>(capacity), make_unique<LRUEvictionPolicy<string>>(capacity), capacity);
+            report("hash+lru", measureLookups(trace, hashes, variant, rounds,
+                [&](const auto& key){ return cache.getPtr(key) != nullptr; }, [&](const string& key){ cache.put(key, 1); }));
+        }
+        {
+            Cache<string, uint64_t> cache(make_unique<FlatHashMapStorage<string, uint64_t>>(capacity), make_unique<ClockEvictionPolicy<string>>(capacity), capacity);
+            report("flat+clock", measureLookups(trace, hashes, variant, rounds,
+                [&](const auto& key){ return cache.getPtr(key) != nullptr; }, [&](const string& key){ cache.put(key, 1); }));
+        }
+        {
+            Cache<string, uint64_t> cache(make_unique<LRUCacheEngine<string, uint64_t>>(capacity), capacity);
+            report("lru-engine", measureLookups(trace, hashes, variant, rounds,
+                [&](const auto& key){ return cache.getPtr(key) != nullptr; }, [&](const string& key){ cache.put(key, 1); }));
+        }
+        {
+            ShardedCache<string, uint64_t> cache(shardCount, capacity,
+                [&]{ return make_unique<HashMapStorage<string, uint64_t>>(capacity / shardCount + 1); },
+                [&]{ return makeEvictionPolicy<string>("clock", capacity / shardCount + 1); });
+            report("sharded-clock", measureLookups(trace, hashes, variant, rounds,
+                [&](const auto& key){ return cache.tryGet(key).has_value(); }, [&](const string& key){ cache.put(key, 1); }));
+        }
+    }
+    return 0;
+}
+
+// Look-aside replay cost with this binary's metrics setting. Build it once with and once
+// without -DCACHE_METRICS=1 and compare the ns_per_op columns for the overhead; an
+// instrumented build also prints the collected stats in the text export format.
+int runMetricsBenchmark(const Options& options){
+    vector<uint64_t> trace = buildTrace(options);
+    size_t capacity = options.getSize("capacity", 10000);
+    size_t rounds = options.getSize("rounds", 3);
+    size_t shardCount = options.getSize("shards", 16);
+    size_t threadCount = options.getSize("threads", 4);
+    string metrics = cacheMetricsEnabled ? "on" : "off";
+
+    cout << "cache,metrics,ns_per_op,hit_ratio" << endl;
+    auto report = [&](const string& name, double nsPerOp, double hitRatio){
+        cout << name << "," << metrics << "," << fixed << setprecision(1) << nsPerOp << "," << setprecision(4) << hitRatio << endl;
+    };
+    CacheStats exported;
+    {
+        Cache<uint64_t, uint64_t> cache(make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity), make_unique<LRUEvictionPolicy<uint64_t>>(capacity), capacity);
+        auto [nsPerOp, hitRatio] = measureStaticVsDynamic(cache, trace, rounds);
+        report("hash+lru", nsPerOp, hitRatio);
+        exported = cache.stats();
+    }
+    {
+        Cache<uint64_t, uint64_t> cache(make_unique<LRUCacheEngine<uint64_t, uint64_t>>(capacity), capacity);
+        auto [nsPerOp, hitRatio] = measureStaticVsDynamic(cache, trace, rounds);
+        report("lru-engine", nsPerOp, hitRatio);
+    }
+    {
+        ShardedCache<uint64_t, uint64_t> cache(shardCount, capacity,
+            [&]{ return make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity / shardCount + 1); },
+            [&]{ return make_unique<ClockEvictionPolicy<uint64_t>>(capacity / shardCount + 1); });
+        size_t opsPerThread = trace.size() * rounds / threadCount;
+        auto [opsPerSec, hitRatio] = measureConcurrent(cache, trace, threadCount, opsPerThread, 0);
+        report("sharded-clock-" + to_string(threadCount) + "t", 1e9 / opsPerSec, hitRatio);
+    }
+    if( cacheMetricsEnabled && options.get("export", "yes") == "yes" ){
+        cout << "\n" << formatStats(exported, "hash_lru") << "get p50 <= " << exported.getLatency.percentile(0.50) << " ns, p99 <= "
+             << exported.getLatency.percentile(0.99) << " ns (sampled)" << endl;
+    }
+    return 0;
+}
+
+// Hit ratio per phase of a trace whose character changes (e.g. Zipf, then a loop just larger
+// than the cache, then Zipf again) for every fixed policy and for AdaptiveEvictionPolicy, plus
+// the sampled hit ratios the adaptive policy observed for its candidates by the end of each phase
+int runAdaptiveBenchmark(const Options& options){
+    size_t capacity = options.getSize("capacity", 10000);
+    size_t keys = options.getSize("keys", 100000);
+    size_t ops = options.getSize("ops", 1000000);
+    double skew = options.getDouble("skew", 0.99);
+    size_t loopKeys = options.getSize("loop-keys", capacity * 3 / 2);
+    double sampleRate = options.getDouble("sample-rate", 0.01);
+    size_t window = options.getSize("window", 1000);
+    vector<string> phases = splitList(options.get("phases", "zipf,loop,zipf"));
+
+    // Each phase gets its own key range, so nothing carries over between phases
+    vector<vector<uint64_t>> traces;
+    for( size_t p = 0; p < phases.size(); p++ ){
+        vector<uint64_t> trace;
+        if( phases[p] == "zipf" ) trace = zipfTrace(keys, ops, skew, p + 1);
+        else if( phases[p] == "loop" ) trace = loopTrace(loopKeys, ops);
+        else if( phases[p] == "scan" ) trace = scanTrace(ops);
+        else if( phases[p] == "mixed" ) trace = mixedTrace(keys, ops, skew, p + 1);
+        else throw invalid_argument("Unknown phase " + phases[p]);
+        for( uint64_t& key : trace ) key += static_cast<uint64_t>(p) << 40;
+        traces.push_back(move(trace));
+    }
+
+    cout << "policy,phase,trace,hit_ratio,live_policy" << endl;
+    vector<string> observed;
+    for( const string& policy : splitList(options.get("policy", "lru,tinylfu,clock,arc,2q,adaptive")) ){
+        AdaptiveEvictionPolicy<uint64_t>* adaptive = nullptr;
+        unique_ptr<IEvictionPolicy<uint64_t>> evictionPolicy;
+        if( policy == "adaptive" ){
+            auto owned = make_unique<AdaptiveEvictionPolicy<uint64_t>>(capacity, AdaptiveEvictionPolicy<uint64_t>::standardCandidates(), sampleRate, window);
+            adaptive = owned.get();
+            evictionPolicy = move(owned);
+        } else {
+            evictionPolicy = makePolicy(policy, capacity);
+        }
+        Cache<uint64_t, uint64_t> cache(make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity), move(evictionPolicy), capacity);
+        for( size_t p = 0; p < phases.size(); p++ ){
+            size_t hits = 0;
+            for( uint64_t key : traces[p] ){
+                if( cache.getPtr(key) ){
+                    hits++;
+                } else {
+                    cache.put(key, key);
+                }
+            }
+            cout << policy << "," << p << "," << phases[p] << "," << fixed << setprecision(4) << static_cast<double>(hits) / max<size_t>(traces[p].size(), 1)
+                 << "," << (adaptive ? adaptive->livePolicyName() : "") << endl;
+            if( adaptive ){
+                for( const AdaptivePolicyStats& candidate : adaptive->policyStats() ){
+                    ostringstream line;
+                    line << p << "," << candidate.name << "," << fixed << setprecision(4) << candidate.hitRatio << "," << candidate.sampledAccesses;
+                    observed.push_back(line.str());
+                }
+            }
+        }
+        if( adaptive ){
+            cout << "adaptive switches: " << adaptive->switchCount() << endl;
+        }
+    }
+    if( !observed.empty() ){
+        cout << "\nphase,candidate,sampled_hit_ratio,sampled_accesses" << endl;
+        for( const string& line : observed ){
+            cout << line << endl;
+        }
+    }
+    return 0;
+}
+
+// Exact LRU miss ratio at sizes step, 2 * step, ... maxCapacity (Mattson's stack algorithm:
+// a reference hits in an LRU cache of size c iff fewer than c distinct keys were referenced
+// since the key's previous reference, counted here with a Fenwick tree over trace positions)
+vector<double> exactMissRatioCurve(const vector<uint64_t>& trace, size_t maxCapacity, size_t step){
+    vector<uint32_t> marks(trace.size() + 1);
+    auto add = [&](size_t position, int delta){
+        for( size_t i = position + 1; i <= trace.size(); i += i & -i ) marks[i] += delta;
+    };
+    auto prefix = [&](size_t position){
+        uint64_t sum = 0;
+        for( size_t i = position + 1; i > 0; i -= i & -i ) sum += marks[i];
+        return sum;
+    };
+    unordered_map<uint64_t, size_t> last;
+    vector<uint64_t> distances(maxCapacity / step + 1);
+    size_t misses = 0;
+    for( size_t i = 0; i < trace.size(); i++ ){
+        auto it = last.find(trace[i]);
+        if( it == last.end() ){
+            misses++;
+            last.emplace(trace[i], i);
+        } else {
+            uint64_t distance = prefix(i) - prefix(it->second);
+            if( distance >= maxCapacity ) misses++;
+            else distances[distance / step]++;
+            add(it->second, -1);
+            it->second = i;
+        }
+        add(i, 1);
+    }
+    vector<double> curve;
+    for( size_t capacity = step; capacity <= maxCapacity; capacity += step ){
+        uint64_t missed = misses;
+        for( size_t b = capacity / step; b < distances.size(); b++ ) missed += distances[b];
+        curve.push_back(static_cast<double>(missed) / max<size_t>(trace.size(), 1));
+    }
+    return curve;
+}
+
+// Miss-ratio curve estimated online by a MissRatioCurveSampler attached to a live Cache,
+// against the exact LRU curve of the same trace, and the sampler's cost per lookup
+int runMissRatioCurveBenchmark(const Options& options){
+    vector<uint64_t> trace = buildTrace(options);
+    size_t maxCapacity = options.getSize("max-capacity", 50000);
+    size_t bins = options.getSize("bins", 50);
+    size_t maxSamples = options.getSize("samples", 8192);
+    size_t capacity = options.getSize("capacity", 10000);
+    size_t step = max<size_t>(1, (maxCapacity + bins - 1) / bins);
+
+    auto sampler = make_shared<MissRatioCurveSampler<uint64_t>>(maxCapacity, bins, maxSamples);
+    Cache<uint64_t, uint64_t> cache(make_unique<HashMapStorage<uint64_t, uint64_t>>(capacity), make_unique<LRUEvictionPolicy<uint64_t>>(capacity), capacity);
+    cache.setMissRatioSampler(sampler);
+    measureStaticVsDynamic(cache, trace, 1);
+
+    // The sampler's own cost per lookup, on a fresh one so the start-up phase is included
+    MissRatioCurveSampler<uint64_t> timed(maxCapacity, bins, maxSamples);
+    auto start = steady_clock::now();
+    for( uint64_t key : trace ){
+        timed.record(key);
+    }
+    double recordNs = duration<double, nano>(steady_clock::now() - start).count() / max<size_t>(trace.size(), 1);
+
+    vector<double> exact = exactMissRatioCurve(trace, maxCapacity, step);
+    vector<MissRatioPoint> estimated = sampler->curve();
+    cout << "capacity,exact_miss_ratio,estimated_miss_ratio,abs_error" << endl;
+    double totalError = 0, maxError = 0;
+    for( size_t i = 0; i < min(exact.size(), estimated.size()); i++ ){
+        double error = abs(exact[i] - estimated[i].missRatio);
+        totalError += error;
+        maxError = max(maxError, error);
+        cout << estimated[i].capacity << "," << fixed << setprecision(4) << exact[i] << "," << estimated[i].missRatio << "," << error << endl;
+    }
+    cout << "\nmean_abs_error " << setprecision(4) << totalError / max<size_t>(exact.size(), 1) << ", max_abs_error " << maxError
+         << ", sampled_keys " << sampler->sampledKeys() << ", sampling_rate " << setprecision(5) << sampler->samplingRate() << endl;
+    cout << "sampler cost per lookup: " << setprecision(1) << recordNs << " ns" << endl;
+    return 0;
+}
+
+// Read latency of MmapStorage against HashMapStorage, write amplification of overwrites with
+// background compaction, and hit ratios of an in-memory Cache spilling its evictions to disk
+int runSpillBenchmark(const Options& options){
+    string directory = options.get("dir", "/tmp/cache-spill");
+    size_t keyCount = options.getSize("keys", 1000000);
+    size_t valueBytes = options.getSize("value-bytes", 100);
+    size_t ops = options.getSize("ops", 2000000);
+    size_t segmentBytes = options.getSize("segment-mb", 64) << 20;
+    uint64_t seed = options.getSize("seed", 1);
+    mt19937_64 rng(seed);
+    uniform_int_distribution<uint64_t> pick(0, keyCount - 1);
+    auto valueOf = [&](uint64_t key, uint64_t version){
+        string val = to_string(key) + ":" + to_string(version);
+        val.resize(valueBytes, '.');
+        return val;
+    };
+
+    cout << "storage,keys,value_bytes,read_p50_ns,read_p99_ns,read_p999_ns" << endl;
+    auto measureReads = [&](const string& name, IStorage<uint64_t, string>& storage){
+        for( uint64_t key = 0; key < keyCount; key++ ){
+            storage.add(key, valueOf(key, 0));
+        }
+        vector<uint32_t> latencies(min(ops, keyCount));
+        for( uint32_t& latency : latencies ){
+            uint64_t key = pick(rng);
+            auto start = steady_clock::now();
+            if( !storage.find(key) ){
+                throw runtime_error(name + ": key missing");
+            }
+            latency = static_cast<uint32_t>(min<int64_t>(duration_cast<nanoseconds>(steady_clock::now() - start).count(), UINT32_MAX));
+        }
+        cout << name << "," << keyCount << "," << valueBytes << "," << fixed << setprecision(0)
+             << percentile(latencies, 0.50) << "," << percentile(latencies, 0.99) << "," << percentile(latencies, 0.999) << endl;
+    };
+    {
+        HashMapStorage<uint64_t, string> memory(keyCount);
+        measureReads("hash", memory);
+    }
+    {
+        MmapStorage<uint64_t, string> disk(directory, segmentBytes);
+        measureReads("mmap", disk);
+    }
+
+    cout << "\ncompact_below,overwrites,user_mb,compaction_mb,write_amplification,disk_mb,live_mb" << endl;
+    for( const string& threshold : splitList(options.get("compact-below", "0.25,0.5,0.75")) ){
+        MmapStorage<uint64_t, string> disk(directory, segmentBytes, stod(threshold));
+        for( uint64_t key = 0; key < keyCount; key++ ){
+            disk.add(key, valueOf(key, 0));
+        }
+        for( size_t i = 0; i < ops; i++ ){
+            uint64_t key = pick(rng);
+            disk.add(key, valueOf(key, i + 1));
+        }
+        disk.waitForCompaction();
+        SpillStats stats = disk.stats();
+        double mb = 1 << 20;
+        cout << threshold << "," << ops << "," << fixed << setprecision(1) << stats.userBytes / mb << "," << stats.compactionBytes / mb << ","
+             << setprecision(2) << stats.writeAmplification() << "," << setprecision(1) << stats.diskBytes / mb << "," << stats.liveBytes / mb << endl;
+    }
+
+    size_t capacity = options.getSize("capacity", keyCount / 10);
+    vector<uint64_t> trace = zipfTrace(keyCount, ops, options.getDouble("skew", 0.99), seed);
+    MmapStorage<uint64_t, string> spill(directory, segmentBytes);
+    Cache<uint64_t, string> memory(make_unique<HashMapStorage<uint64_t, string>>(capacity), make_unique<LRUEvictionPolicy<uint64_t>>(capacity), capacity);
+    memory.setEvictionListener([&](const uint64_t& key, const string& val){ spill.add(key, val); });
+    size_t memoryHits = 0, diskHits = 0;
+    for( uint64_t key : trace ){
+        if( memory.getPtr(key) ){
+            memoryHits++;
+        } else if( string* val = spill.find(key) ){
+            diskHits++;
+            string promoted = move(*val);
+            spill.remove(key);
+            memory.put(key, promoted);
+        } else {
+            memory.put(key, valueOf(key, 0));
+        }
+    }
+    cout << "\nmemory_capacity,keys,ops,memory_hit_ratio,disk_hit_ratio,spilled_entries" << endl;
+    cout << capacity << "," << keyCount << "," << trace.size() << "," << fixed << setprecision(4)
+         << static_cast<double>(memoryHits) / trace.size() << "," << static_cast<double>(diskHits) / trace.size() << "," << spill.size() << endl;
+    return 0;
+}
+
+// Synthetic JSON documents of --min-bytes to --max-bytes: records with repeated field names
+// and random ids, scores and dates, which compress about as well as typical API payloads
+string jsonBlob(mt19937_64& rng, size_t bytes){
+    static const char* names[] = {"alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi"};
+    static const char* tags[] = {"new", "premium", "trial", "churned", "beta", "staff"};
+    string blob = "{\"items\":[";
+    uint64_t id = rng() % 1000000;
+    while( blob.size() + 2 < bytes ){
+        uint64_t r = rng();
+        blob += "{\"id\":" + to_string(id++) + ",\"name\":\"" + names[r % 8] + "\",\"email\":\"" + names[r % 8] + "@example.com\",\"active\":"
+              + ((r >> 3) % 4 ? "true" : "false") + ",\"score\":" + to_string((r >> 5) % 100) + ",\"tags\":[\"" + tags[(r >> 12) % 6]
+              + "\",\"" + tags[(r >> 15) % 6] + "\"],\"created\":\"2026-10-1" + to_string((r >> 18) % 10) + "T00:00:00Z\"},";
+    }
+    blob.resize(bytes - 2);
+    blob += "]}";
+    return blob;
+}
+
+// Memory saved by CompressedStorage against its CPU cost: LzCodec throughput on the values,
+// then the footprint and zipf get latency of a Cache holding every key, plain and compressed
+// with each --hot set size
+int runCompressionBenchmark(const Options& options){
+    size_t keyCount = options.getSize("keys", 2000);
+    size_t ops = options.getSize("ops", 200000);
+    size_t minBytes = options.getSize("min-bytes", 2048);
+    size_t maxBytes = options.getSize("max-bytes", 51200);
+    size_t threshold = options.getSize("threshold", 1024);
+    uint64_t seed = options.getSize("seed", 1);
+    if( minBytes < 4 || maxBytes < minBytes ){
+        throw invalid_argument("compress: need 4 <= --min-bytes <= --max-bytes");
+    }
+    mt19937_64 rng(seed);
+    uniform_int_distribution<size_t> size(minBytes, maxBytes);
+    vector<string> values(keyCount);
+    size_t rawBytes = 0;
+    for( string& val : values ){
+        val = jsonBlob(rng, size(rng));
+        rawBytes += val.size();
+    }
+    double mb = 1 << 20;
+
+    vector<string> packed(keyCount);
+    auto start = steady_clock::now();
+    for( size_t i = 0; i < keyCount; i++ ){
+        LzCodec::compress(values[i], packed[i]);
+    }
+    double compressSeconds = duration<double>(steady_clock::now() - start).count();
+    size_t packedBytes = 0;
+    string decoded;
+    start = steady_clock::now();
+    for( size_t i = 0; i < keyCount; i++ ){
+        decoded.resize(values[i].size());
+        LzCodec::decompress(packed[i], decoded.data(), decoded.size());
+        packedBytes += packed[i].size();
+    }
+    double decompressSeconds = duration<double>(steady_clock::now() - start).count();
+    cout << "values,raw_mb,compressed_mb,ratio,compress_mb_s,decompress_mb_s" << endl;
+    cout << keyCount << "," << fixed << setprecision(1) << rawBytes / mb << "," << packedBytes / mb << "," << setprecision(2)
+         << static_cast<double>(rawBytes) / packedBytes << "," << setprecision(0) << rawBytes / mb / compressSeconds << ","
+         << rawBytes / mb / decompressSeconds << endl;
+
+    vector<uint64_t> trace = zipfTrace(keyCount, ops, options.getDouble("skew", 0.99), seed);
+    cout << "\nstorage,hot_entries,value_mb,hot_mb,saved_pct,get_ns,decompressions_per_get,hot_hit_ratio" << endl;
+    auto measure = [&](const string& name, size_t hotEntries, unique_ptr<IStorage<uint64_t, string>> storage, auto statsOf){
+        Cache<uint64_t, string> cache(move(storage), make_unique<LRUEvictionPolicy<uint64_t>>(keyCount), keyCount);
+        for( uint64_t key = 0; key < keyCount; key++ ){
+            cache.put(key, values[key]);
+        }
+        auto start = steady_clock::now();
+        for( uint64_t key : trace ){
+            if( !cache.getPtr(key) ){
+                throw runtime_error(name + ": key missing");
+            }
+        }
+        double ns = duration<double, nano>(steady_clock::now() - start).count() / trace.size();
+        CompressionStats stats = statsOf();
+        cout << name << "," << hotEntries << "," << fixed << setprecision(1) << stats.storedBytes / mb << "," << stats.hotBytes / mb << ","
+             << 100.0 * (1 - static_cast<double>(stats.storedBytes + stats.hotBytes) / rawBytes) << "," << setprecision(0) << ns << ","
+             << setprecision(3) << static_cast<double>(stats.decompressions) / trace.size() << ","
+             << static_cast<double>(stats.hotHits) / trace.size() << endl;
+    };
+    measure("plain", 0, make_unique<HashMapStorage<uint64_t, string>>(keyCount), [&]{
+        CompressionStats stats;
+        stats.storedBytes = rawBytes;
+        return stats;
+    });
+    for( const string& hot : splitList(options.get("hot", "0,64,256")) ){
+        auto storage = make_unique<CompressedStorage<uint64_t, string>>(
+            make_unique<HashMapStorage<uint64_t, CompressedValue<string>>>(keyCount), threshold, stoul(hot));
+        CompressedStorage<uint64_t, string>* compressed = storage.get();
+        measure("compressed", stoul(hot), move(storage), [&]{ return compressed->stats(); });
+    }
+    return 0;
+}
+
+// Warm restart: time to save a full cache of --entries keys, to load it back in bulk, and to
+// rebuild the same cache by replaying one put per snapshot entry
+int runSnapshotBenchmark(const Options& options){
+    size_t entries = options.getSize("entries", 10000000);
+    string path = options.get("out", "/tmp/cache.snap");
+    string policy = options.get("policy", "lru");
+    string storage = options.get("storage", "hash");
+    auto seconds = [](auto body){
+        auto start = steady_clock::now();
+        body();
+        return duration<double>(steady_clock::now() - start).count();
+    };
+
+    double saveSeconds;
+    {
+        auto cache = makeCache(policy, storage, entries, milliseconds(0));
+        for( uint64_t key = 0; key < entries; key++ ){
+            cache->put(key * 0x9E3779B97F4A7C15ULL, key);
+        }
+        saveSeconds = seconds([&]{ cache->saveSnapshot(path); });
+    }
+    size_t loaded = 0;
+    double loadSeconds;
+    {
+        auto cache = makeCache(policy, storage, entries, milliseconds(0));
+        loadSeconds = seconds([&]{ cache->loadSnapshot(path); });
+        loaded = cache->size();
+    }
+    double replaySeconds;
+    {
+        auto cache = makeCache(policy, storage, entries, milliseconds(0));
+        replaySeconds = seconds([&]{
+            SnapshotReader<uint64_t, uint64_t> snapshot(path);
+            for( size_t i = 0; i < snapshot.size(); i++ ){
+                cache->put(snapshot.keys[i], snapshot.value(i));
+            }
+        });
+    }
+    if( loaded != entries ){
+        throw runtime_error("snapshot benchmark: loaded " + to_string(loaded) + " of " + to_string(entries) + " entries");
+    }
+
+    cout << "policy,storage,entries,file_mb,save_s,load_s,replay_put_s" << endl;
+    cout << policy << "," << (policy == "lru-engine" ? "engine" : storage) << "," << entries << "," << fixed << setprecision(1)
+         << filesystem::file_size(path) / double(1 << 20) << "," << setprecision(2) << saveSeconds << "," << loadSeconds << "," << replaySeconds << endl;
+    filesystem::remove(path);
+    return 0;
+}
+
+// Blocking client socket to a running Server: the Unix socket at --unix if given, else 127.0.0.1:--port
+int connectToServer(const Options& options){
+    string unixPath = options.get("unix", "");
+    int fd;
+    if( !unixPath.empty() ){
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, unixPath.c_str(), sizeof(address.sun_path) - 1);
+        if( connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ){
+            throw system_error(errno, generic_category(), "connect " + unixPath);
+        }
+        return fd;
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(options.getSize("port", 6380)));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if( connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ){
+        throw system_error(errno, generic_category(), "connect 127.0.0.1");
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+void appendRespCommand(string& out, initializer_list<string_view> args){
+    out += "*" + to_string(args.size()) + "\r\n";
+    for( string_view arg : args ){
+        out += "$" + to_string(arg.size()) + "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+}
+
+// Sends a pipelined batch and reads its `count` replies. Returns how many were GET hits.
+size_t roundTrip(int fd, const string& request, size_t count, string& buffer){
+    for( size_t sent = 0; sent < request.size(); ){
+        ssize_t n = write(fd, request.data() + sent, request.size() - sent);
+        if( n <= 0 ) throw system_error(errno, generic_category(), "write");
+        sent += n;
+    }
+    buffer.clear();
+    size_t pos = 0, replies = 0, hits = 0;
+    char chunk[64 << 10];
+    while( replies < count ){
+        optional<size_t> length = respReplyLength(buffer, pos);
+        if( !length ){
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if( n <= 0 ) throw runtime_error("server closed the connection");
+            buffer.append(chunk, n);
+            continue;
+        }
+        if( buffer[pos] == '-' ){
+            throw runtime_error("server error: " + buffer.substr(pos, *length - 2));
+        }
+        hits += buffer[pos] == '$' && buffer[pos + 1] != '-';
+        pos += *length;
+        replies++;
+    }
+    return hits;
+}
+
+// Load generator for Server: --connections client threads, one socket each, send --pipeline
+// commands per round trip (GETs, and SETs for --write-pct percent) over a Zipf key trace.
+// Prints throughput and the latency of a whole batch.
+int runServerBenchmark(const Options& options){
+    size_t keyCount = options.getSize("keys", 100000);
+    size_t ops = options.getSize("ops", 1000000);
+    size_t valueBytes = options.getSize("value-bytes", 100);
+    size_t writePercent = options.getSize("write-pct", 10);
+    uint64_t seed = options.getSize("seed", 1);
+    vector<uint64_t> trace = zipfTrace(keyCount, ops, options.getDouble("skew", 0.99), seed);
+    string value(valueBytes, 'v');
+    auto keyName = [](uint64_t key){ return "key:" + to_string(key); };
+
+    if( options.get("preload", "yes") == "yes" ){
+        int fd = connectToServer(options);
+        string request, buffer;
+        for( uint64_t start = 0; start < keyCount; start += 1000 ){
+            request.clear();
+            uint64_t end = min<uint64_t>(start + 1000, keyCount);
+            for( uint64_t key = start; key < end; key++ ){
+                appendRespCommand(request, {"SET", keyName(key), value});
+            }
+            roundTrip(fd, request, end - start, buffer);
+        }
+        close(fd);
+    }
+
+    cout << "connections,pipeline,ops_per_sec,batch_p50_us,batch_p99_us,batch_p999_us,hit_ratio" << endl;
+    for( const string& connectionsText : splitList(options.get("connections", "1,4,16")) ){
+        for( const string& pipelineText : splitList(options.get("pipeline", "1,16,128")) ){
+            size_t connectionCount = stoull(connectionsText);
+            size_t pipeline = max<size_t>(stoull(pipelineText), 1);
+            size_t batchesPerConnection = max<size_t>(ops / connectionCount / pipeline, 1);
+            vector<vector<uint32_t>> latencies(connectionCount);
+            atomic<size_t> hits{0}, gets{0};
+            vector<int> sockets;
+            for( size_t c = 0; c < connectionCount; c++ ){
+                sockets.push_back(connectToServer(options));
+            }
+            vector<thread> clients;
+            auto start = steady_clock::now();
+            for( size_t c = 0; c < connectionCount; c++ ){
+                clients.emplace_back([&, c]{
+                    string request, buffer;
+                    size_t next = c * trace.size() / connectionCount;
+                    size_t localHits = 0, localGets = 0;
+                    latencies[c].reserve(batchesPerConnection);
+                    for( size_t b = 0; b < batchesPerConnection; b++ ){
+                        request.clear();
+                        for( size_t i = 0; i < pipeline; i++, next++ ){
+                            string key = keyName(trace[next % trace.size()]);
+                            if( next % 100 < writePercent ){
+                                appendRespCommand(request, {"SET", key, value});
+                            } else {
+                                appendRespCommand(request, {"GET", key});
+                                localGets++;
+                            }
+                        }
+                        auto sent = steady_clock::now();
+                        localHits += roundTrip(sockets[c], request, pipeline, buffer);
+                        latencies[c].push_back(static_cast<uint32_t>(min<int64_t>(duration_cast<nanoseconds>(steady_clock::now() - sent).count(), UINT32_MAX)));
+                    }
+                    hits += localHits;
+                    gets += localGets;
+                });
+            }
+            for( thread& client : clients ){
+                client.join();
+            }
+            double seconds = duration<double>(steady_clock::now() - start).count();
+            for( int fd : sockets ){
+                close(fd);
+            }
+            vector<uint32_t> all;
+            for( vector<uint32_t>& perConnection : latencies ){
+                all.insert(all.end(), perConnection.begin(), perConnection.end());
+            }
+            double total = static_cast<double>(connectionCount * batchesPerConnection * pipeline);
+            cout << connectionCount << "," << pipeline << "," << fixed << setprecision(0) << total / seconds << "," << setprecision(1)
+                 << percentile(all, 0.50) / 1000 << "," << percentile(all, 0.99) / 1000 << "," << percentile(all, 0.999) / 1000 << ","
+                 << setprecision(4) << (gets ? static_cast<double>(hits) / gets : 0) << endl;
+        }
+    }
+    return 0;
+}
+
+// Hammers a small ConcurrentCache with reads, puts and removes from many threads and checks
+// that every value read belongs to its key. Values are heap-allocated strings, so a node freed
+// too early shows up as a corrupt value, and as an error when built with -fsanitize=thread
+// or -fsanitize=address.
+int runStressTest(const Options& options){
+    size_t threadCount = options.getSize("threads", 8);
+    size_t keyCount = options.getSize("keys", 1000);
+    size_t capacity = options.getSize("capacity", 256);
+    size_t shardCount = options.getSize("shards", 4);
+    milliseconds runFor(options.getSize("ms", 2000));
+
+    ConcurrentCache<uint64_t, string> cache(shardCount, capacity);
+    auto valueOf = [](uint64_t key, uint64_t version){
+        return "key " + to_string(key) + " version " + to_string(version);
+    };
+    atomic<bool> stop{false};
+    atomic<size_t> reads{0}, writes{0}, corrupt{0};
+    vector<thread> threads;
+    for( size_t t = 0; t < threadCount; t++ ){
+        threads.emplace_back([&, t]{
+            mt19937_64 rng(t + 1);
+            uniform_int_distribution<uint64_t> pickKey(0, keyCount - 1);
+            size_t localReads = 0, localWrites = 0, localCorrupt = 0;
+            for( uint64_t version = 0; !stop.load(memory_order_relaxed); version++ ){
+                uint64_t key = pickKey(rng);
+                size_t roll = rng() % 100;
+                if( roll < 10 ){
+                    cache.put(key, valueOf(key, version));
+                    localWrites++;
+                } else if( roll < 12 ){
+                    cache.remove(key);
+                    localWrites++;
+                } else if( optional<string> val = cache.tryGet(key) ){
+                    string prefix = "key " + to_string(key) + " ";
+                    localCorrupt += val->compare(0, prefix.size(), prefix) != 0;
+                    localReads++;
+                }
+            }
+            reads += localReads;
+            writes += localWrites;
+            corrupt += localCorrupt;
+        });
+    }
+    this_thread::sleep_for(runFor);
+    stop = true;
+    for( thread& t : threads ){
+        t.join();
+    }
+
+    size_t perShard = (capacity + shardCount - 1) / shardCount;
+    bool withinCapacity = cache.size() <= perShard * shardCount;
+    // With every reader gone, two epoch advances free everything still retired
+    for( int i = 0; i < 3; i++ ){
+        cache.reclaimRetired();
+    }
+    size_t leftover = cache.retiredCount();
+    cout << "threads=" << threadCount << " hits=" << reads << " writes=" << writes << " corrupt=" << corrupt
+         << " size=" << cache.size() << " unreclaimed=" << leftover << endl;
+    if( corrupt || !withinCapacity || leftover ){
+        cout << "FAILED" << endl;
+        return 1;
+    }
+    cout << "OK" << endl;
+    return 0;
+}
+
+void printUsage(){
+    cout << "Usage: Benchmark <mode> [--option value ...]\n"
+         << "\n"
+         << "Modes:\n"
+         << "  trace   Replay a key trace against storage/policy combinations and print CSV\n"
+         << "          --policy   lru,clock,tinylfu,arc,2q,adaptive,lru-engine (comma separated, default lru)\n"
+         << "          --storage  hash | flat | ttl (default hash)   --ttl-ms N (ttl storage, default 60000)\n"
+         << "          --capacity N (default 10000)\n"
+         << "          --trace    zipf | scan | loop | mixed | <file> (default zipf)\n"
+         << "                     files ending in .bin hold raw uint64 keys, others one key per line\n"
+         << "          --keys N (default 100000)  --ops N (default 1000000)  --skew S (default 0.99)  --seed N\n"
+         << "          --header   yes | no (default yes)\n"
+         << "  gentrace  Write a synthetic trace to a binary file: same trace options plus --out <file.bin>\n"
+         << "  static  Per-op latency of runtime-composed Cache vs compile-time StaticCache (hash+lru and lru-engine)\n"
+         << "          same trace options plus --capacity N (default 10000) and --rounds N (default 3)\n"
+         << "  multiget  multiGet/multiPut vs a per-key loop on a ShardedCache holding --keys entries\n"
+         << "          --keys N (default 1000000)  --batch 50,500  --shards N (default 16)  --ops N (default 2000000)\n"
+         << "          --policy lru | clock | tinylfu | arc | 2q (default lru)\n"
+         << "  flat    Insert/lookup/erase ns per op of HashMapStorage vs FlatHashMapStorage\n"
+         << "          --keys 1000000,50000000 (comma separated)  --ops N lookups (default 10000000)\n"
+         << "  concurrent  Read-mostly throughput of ShardedCache (lru, clock) vs lock-free-read ConcurrentCache\n"
+         << "          same trace options plus --threads 1,2,4,8,16,32,64  --thread-ops N (default 1000000)\n"
+         << "          --write-pct N (default 1)  --capacity N (default 50000)  --shards N (default 16)\n"
+         << "  tiered  Per-thread L1 + shared L2 (TieredCache) vs ShardedCache alone, with L1 and L2 hit ratios\n"
+         << "          same options as concurrent plus --l1 N entries per thread (default 256)  --revalidate N (default 1)\n"
+         << "  adaptive  Per-phase hit ratio of fixed policies vs AdaptiveEvictionPolicy on a trace that changes character\n"
+         << "          --phases zipf,loop,zipf (zipf | loop | scan | mixed)  --ops N per phase (default 1000000)  --keys N  --skew S\n"
+         << "          --loop-keys N (default 1.5 x capacity)  --capacity N (default 10000)  --sample-rate R (default 0.01)  --window N (default 1000)\n"
+         << "          --policy lru,tinylfu,clock,arc,2q,adaptive\n"
+         << "  mrc     Online miss-ratio curve of a sampled Cache vs the exact LRU curve of the same trace\n"
+         << "          same trace options plus --max-capacity N (default 50000)  --bins N (default 50)\n"
+         << "          --samples N tracked keys (default 8192)  --capacity N of the live cache (default 10000)\n"
+         << "  lookup  ns per op of string-key lookups that build a std::string, pass a string_view as a HashedKey,\n"
+         << "          or pass a HashedKey with a precomputed hash. Same trace options plus --capacity N (default 50000)\n"
+         << "          --key-bytes N (default 40)  --rounds N (default 3)  --shards N (default 16)\n"
+         << "  metrics  ns per op of Cache (hash+lru, lru-engine) and a ShardedCache with this build's metrics setting;\n"
+         << "          build with and without -DCACHE_METRICS=1 to compare. Same trace options plus --capacity N (default 10000)\n"
+         << "          --rounds N (default 3)  --threads N (default 4)  --shards N (default 16)  --export yes | no (default yes)\n"
+         << "  spill   MmapStorage read latency vs HashMapStorage, write amplification, and a Cache spilling to it\n"
+         << "          --dir DIR (default /tmp/cache-spill)  --keys N (default 1000000)  --value-bytes N (default 100)\n"
+         << "          --ops N (default 2000000)  --segment-mb N (default 64)  --compact-below 0.25,0.5,0.75\n"
+         << "          --capacity N in-memory entries (default keys / 10)  --skew S (default 0.99)\n"
+         << "  compress  Memory saved vs CPU cost of CompressedStorage: codec MB/s and ratio on synthetic JSON values,\n"
+         << "          then value MB and zipf get ns/op of a Cache holding every key, plain and compressed\n"
+         << "          --keys N (default 2000)  --min-bytes N (default 2048)  --max-bytes N (default 51200)  --ops N (default 200000)\n"
+         << "          --threshold N bytes (default 1024)  --hot 0,64,256 decoded entries kept  --skew S (default 0.99)\n"
+         << "  snapshot  Save, bulk load and put-replay times of a full cache of --entries keys (default 10000000)\n"
+         << "          --policy as in trace (default lru)  --storage hash | flat (default hash)  --out FILE (default /tmp/cache.snap)\n"
+         << "  server  Load generator for a running Server: ops/s and batch latency per connection count and pipeline depth\n"
+         << "          --port N (default 6380) | --unix PATH  --connections 1,4,16  --pipeline 1,16,128  --ops N (default 1000000)\n"
+         << "          --keys N (default 100000)  --value-bytes N (default 100)  --write-pct N (default 10)  --skew S  --preload yes | no\n"
+         << "  stress  Concurrent get/put/remove on a small ConcurrentCache, checking values and reclamation\n"
+         << "          --threads N (default 8)  --keys N (default 1000)  --capacity N (default 256)  --ms N (default 2000)\n";
+}
+
+int main(int argc, char** argv){
+    if( argc < 2 ){
+        printUsage();
+        return 1;
+    }
+    string mode = argv[1];
+    try{
+        Options options(argc, argv, 2);
+        if( mode == "trace" ){
+            return runTraceBenchmark(options);
+        }
+        if( mode == "static" ){
+            return runStaticBenchmark(options);
+        }
+        if( mode == "multiget" ){
+            return runMultiGetBenchmark(options);
+        }
+        if( mode == "flat" ){
+            return runFlatStorageBenchmark(options);
+        }
+        if( mode == "concurrent" ){
+            return runConcurrentBenchmark(options);
+        }
+        if( mode == "tiered" ){
+            return runTieredBenchmark(options);
+        }
+        if( mode == "adaptive" ){
+            return runAdaptiveBenchmark(options);
+        }
+        if( mode == "mrc" ){
+            return runMissRatioCurveBenchmark(options);
+        }
+        if( mode == "lookup" ){
+            return runLookupBenchmark(options);
+        }
+        if( mode == "metrics" ){
+            return runMetricsBenchmark(options);
+        }
+        if( mode == "spill" ){
+            return runSpillBenchmark(options);
+        }
+        if( mode == "compress" ){
+            return runCompressionBenchmark(options);
+        }
+        if( mode == "snapshot" ){
+            return runSnapshotBenchmark(options);
+        }
+        if( mode == "server" ){
+            return runServerBenchmark(options);
+        }
+        if( mode == "stress" ){
+            return runStressTest(options);
+        }
+        if( mode == "gentrace" ){
+            saveTrace(options.get("out", "trace.bin"), buildTrace(options));
+            return 0;
+        }
+    } catch( const exception& e ){
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    printUsage();
+    return 1;
+}
@@ -0,0 +1,1562 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "Allocators.h"
+#include "Epoch.h"
+#include "EvictionPolicies.h"
+#include "Loaders.h"
+#include "Metrics.h"
+#include "MissRatioCurve.h"
+#include "Snapshot.h"
+#include "SpillStorage.h"
+#include "Storage.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Storage and recency tracking fused into a single structure.
+// Cache uses an engine as a fast path instead of separate IStorage/IEvictionPolicy objects.
+template<typename T, typename V>
+class ICacheEngine{
+public:
+    // Stores the value and marks the key most recently used; returns true if the key was new
+    virtual bool insertOrAssign(const T& key, const V& val) = 0;
+    // Returns the stored value and marks the key most recently used, or nullptr if absent
+    virtual V* find(const T& key) = 0;
+    // Lookup by view with the caller's hash; engines without a transparent index build a T
+    virtual V* find(const HashedKey<T>& key){
+        return find(T(key.key));
+    }
+    virtual T evict() = 0;
+    virtual void remove(const T& key) = 0;
+    virtual size_t size() const = 0;
+    // Hint that find(key) follows soon, so batched lookups can overlap their memory misses
+    virtual void prefetch(const T& key) const{}
+    // Visits every entry from the next victim to the most recently used one
+    virtual void forEachInEvictionOrder(const function<void(const T&, const V&)>& visit) const{
+        throw logic_error("This cache engine does not support snapshots");
+    }
+    // Makes room for `entries` keys in total ahead of a bulk load
+    virtual void reserve(size_t entries){}
+
+    virtual ~ICacheEngine() = default;
+};
+
+// LRU engine whose map node holds both the value and the recency links,
+// so every get/put reaches all of its state through one hash lookup.
+template<typename T, typename V, typename Alloc = allocator<pair<const T, V>>>
+class LRUCacheEngine : public ICacheEngine<T, V>{
+private:
+    struct Node{
+        V value;
+        const T* key = nullptr;
+        Node* prev = nullptr;   // towards the most recently used end
+        Node* next = nullptr;   // towards the least recently used end
+
+        Node(const V& _value) : value(_value){}
+    };
+
+    unordered_map<T, Node, KeyHash<T>, KeyEqual<T>, typename allocator_traits<Alloc>::template rebind_alloc<pair<const T, Node>>> data;
+    Node* head = nullptr;
+    Node* tail = nullptr;
+
+    void unlink(Node* node){
+        (node->prev ? node->prev->next : head) = node->next;
+        (node->next ? node->next->prev : tail) = node->prev;
+    }
+
+    void pushFront(Node* node){
+        node->prev = nullptr;
+        node->next = head;
+        (head ? head->prev : tail) = node;
+        head = node;
+    }
+
+    void moveToFront(Node* node){
+        if( node != head ){
+            unlink(node);
+            pushFront(node);
+        }
+    }
+
+    // Key is T or HashedKey<T>
+    template<typename Key>
+    V* findAndTouch(const Key& key){
+        auto it = data.find(key);
+        if( it == data.end() ){
+            return nullptr;
+        }
+        moveToFront(&it->second);
+        return &it->second.value;
+    }
+
+public:
+    LRUCacheEngine(const Alloc& alloc = Alloc()) : data(0, KeyHash<T>(), KeyEqual<T>(), alloc){}
+
+    // Sizes the map up front so it never rehashes while the cache stays within capacity
+    LRUCacheEngine(size_t capacity, const Alloc& alloc = Alloc()) : LRUCacheEngine(alloc){
+        data.reserve(capacity + 1);
+    }
+
+    bool insertOrAssign(const T& key, const V& val) override{
+        auto [it, inserted] = data.try_emplace(key, val);
+        Node* node = &it->second;
+        if( inserted ){
+            node->key = &it->first;
+            pushFront(node);
+        } else {
+            node->value = val;
+            moveToFront(node);
+        }
+        return inserted;
+    }
+
+    V* find(const T& key) override{
+        return findAndTouch(key);
+    }
+
+    V* find(const HashedKey<T>& key) override{
+        return findAndTouch(key);
+    }
+
+    T evict() override{
+        if( !tail ){
+            throw runtime_error("No item to evict");
+        }
+        Node* victim = tail;
+        unlink(victim);
+        T lastKey = *victim->key;
+        data.erase(lastKey);
+        return lastKey;
+    }
+
+    void remove(const T& key) override{
+        auto it = data.find(key);
+        if( it != data.end() ){
+            unlink(&it->second);
+            data.erase(it);
+        }
+    }
+
+    size_t size() const override{
+        return data.size();
+    }
+
+    void forEachInEvictionOrder(const function<void(const T&, const V&)>& visit) const override{
+        for( const Node* node = tail; node; node = node->prev ){
+            visit(*node->key, node->value);
+        }
+    }
+
+    void reserve(size_t entries) override{
+        data.reserve(entries);
+    }
+};
+
+
+// Requirements on the policy types of StaticCache. Every IStorage / IEvictionPolicy / ICacheEngine
+// implementation models them, and so can any class with the same members and no virtual calls.
+template<typename S, typename K, typename V>
+concept CacheStorage = requires(S storage, const K& key, const V& val, milliseconds ttl, function<void(const K&)> listener){
+    { storage.find(key) } -> convertible_to<V*>;
+    storage.add(key, val);
+    storage.add(key, val, ttl);
+    storage.remove(key);
+    { storage.exists(key) } -> convertible_to<bool>;
+    { storage.size() } -> convertible_to<size_t>;
+    storage.setExpirationListener(listener);
+    { storage.concurrentReads() } -> convertible_to<bool>;
+};
+
+template<typename P, typename K>
+concept CacheEvictionPolicy = requires(P policy, const K& key){
+    policy.keyAccessed(key);
+    policy.keyMissed(key);
+    policy.keyRemoved(key);
+    { policy.evict() } -> convertible_to<K>;
+    { policy.concurrentHits() } -> convertible_to<bool>;
+};
+
+template<typename E, typename K, typename V>
+concept CacheEngine = requires(E engine, const K& key, const V& val){
+    { engine.insertOrAssign(key, val) } -> convertible_to<bool>;
+    { engine.find(key) } -> convertible_to<V*>;
+    { engine.evict() } -> convertible_to<K>;
+    engine.remove(key);
+    { engine.size() } -> convertible_to<size_t>;
+};
+
+// Eviction policy placeholder for StaticCache instantiations whose storage is a CacheEngine
+struct EngineManagedEviction{};
+
+// Cache with its storage and eviction policy fixed at compile time and held by value, so
+// calls into them are direct (devirtualized) and the whole hit path can inline into get().
+// StoragePolicy is either a CacheStorage paired with a CacheEvictionPolicy, or a CacheEngine
+// that manages recency itself (with EvictionPolicy left as EngineManagedEviction).
+template<typename K, typename V, typename StoragePolicy, typename EvictionPolicy = EngineManagedEviction>
+    requires (CacheStorage<StoragePolicy, K, V> && CacheEvictionPolicy<EvictionPolicy, K>)
+          || (CacheEngine<StoragePolicy, K, V> && same_as<EvictionPolicy, EngineManagedEviction>)
+class StaticCache{
+public:
+    using Weigher = function<size_t(const K&, const V&)>;
+    using EvictionListener = function<void(const K&, const V&)>;
+
+private:
+    static constexpr bool usesEngine = same_as<EvictionPolicy, EngineManagedEviction>;
+
+    StoragePolicy storage;
+    [[no_unique_address]] EvictionPolicy policy;
+    size_t capacity;
+    // With a weigher, capacity is a budget in weight units (e.g. bytes) instead of an entry count
+    Weigher weigher;
+    unordered_map<K, size_t> weights;
+    size_t totalWeight = 0;
+    EvictionListener evictionListener;
+    [[no_unique_address]] Metrics metrics;
+    shared_ptr<MissRatioCurveSampler<K>> missRatioSampler;
+
+public:
+    StaticCache(size_t _capacity, StoragePolicy _storage = StoragePolicy(), EvictionPolicy _policy = EvictionPolicy()) : storage(move(_storage)), policy(move(_policy)), capacity(_capacity){
+        if constexpr( !usesEngine ){
+            // Keys the storage drops on its own must leave the policy too, so evict() only picks live keys
+            storage.setExpirationListener([this](const K& key){
+                policy.keyRemoved(key);
+                forgetWeight(key);
+                metrics.count(CacheMetrics::Expirations);
+            });
+        }
+    }
+
+    // Byte-weighted caches: entries are evicted until the total weight fits in maxWeight
+    StaticCache(size_t maxWeight, Weigher _weigher, StoragePolicy _storage = StoragePolicy(), EvictionPolicy _policy = EvictionPolicy()) : StaticCache(maxWeight, move(_storage), move(_policy)){
+        weigher = move(_weigher);
+    }
+
+    // The storage's expiration listener points back at this object
+    StaticCache(StaticCache&&) = delete;
+    StaticCache& operator=(StaticCache&&) = delete;
+
+private:
+    void forgetWeight(const K& key){
+        if( !weigher ) return;
+        auto it = weights.find(key);
+        if( it != weights.end() ){
+            totalWeight -= it->second;
+            weights.erase(it);
+        }
+    }
+
+    size_t weightOf(const K& key) const{
+        auto it = weights.find(key);
+        return it != weights.end() ? it->second : 0;
+    }
+
+    void recordWeight(const K& key, size_t weight){
+        size_t& recorded = weights[key];
+        totalWeight = totalWeight - recorded + weight;
+        recorded = weight;
+    }
+
+    void evictOne(){
+        metrics.count(CacheMetrics::Evictions);
+        if constexpr( usesEngine ){
+            forgetWeight(storage.evict());
+        } else {
+            K victim = policy.evict();
+            if( evictionListener ){
+                if( V* val = storage.find(victim) ){
+                    evictionListener(victim, *val);
+                }
+            }
+            storage.remove(victim);
+            forgetWeight(victim);
+        }
+    }
+
+    // A value heavier than the whole budget is rejected up front, and drops any older value
+    bool rejectOversized(const K& key, size_t weight){
+        if( weight <= capacity ) return false;
+        remove(key);
+        return true;
+    }
+
+    template<typename AddFn>
+    bool insert(const K& key, const V& val, AddFn add){
+        auto timer = metrics.time(CacheMetrics::Put);
+        size_t weight = weigher ? weigher(key, val) : 0;
+        if( weigher && rejectOversized(key, weight) ){
+            return false;
+        }
+        if( storage.exists(key) ){
+            if( weigher && totalWeight - weightOf(key) + weight > capacity ){
+                // Make room among the other keys first. With the key out of the policy, evict()
+                // cannot pick it (CLOCK and ARC otherwise can), and it is readmitted as new.
+                policy.keyRemoved(key);
+                forgetWeight(key);
+                while( totalWeight + weight > capacity ){
+                    evictOne();
+                }
+                policy.keyMissed(key);
+            }
+            add();
+            timer.count(CacheMetrics::Puts);
+            policy.keyAccessed(key);
+            if( weigher ){
+                recordWeight(key, weight);
+            }
+            return true;
+        }
+        policy.keyMissed(key);
+        if( weigher ){
+            // One heavy insert may need several victims before it fits
+            while( totalWeight + weight > capacity ){
+                evictOne();
+            }
+        } else if( storage.size() == capacity ){
+            evictOne();
+        }
+        add();
+        timer.count(CacheMetrics::Puts);
+        if( weigher ){
+            recordWeight(key, weight);
+        }
+        policy.keyAccessed(key);
+        return true;
+    }
+
+    // Key is K or HashedKey<K>. Storages and policies without a HashedKey overload get a K.
+    template<typename Key>
+    const V* lookup(const Key& key){
+        auto timer = metrics.time(CacheMetrics::Get);
+        if( missRatioSampler ){
+            missRatioSampler->record(key);
+        }
+        const V* found = findResident(key);
+        timer.count(found ? CacheMetrics::Hits : CacheMetrics::Misses);
+        return found;
+    }
+
+    template<typename Key>
+    const V* findResident(const Key& key){
+        V* val;
+        if constexpr( requires{ storage.find(key); } ){
+            val = storage.find(key);
+        } else {
+            val = storage.find(ownedKey(key));
+        }
+        if constexpr( !usesEngine ){
+            if( val ){
+                if constexpr( requires{ policy.keyAccessed(key); } ){
+                    policy.keyAccessed(key);
+                } else {
+                    policy.keyAccessed(ownedKey(key));
+                }
+            }
+        }
+        return val;
+    }
+
+public:
+    // Returns false if the value was rejected for weighing more than the whole budget
+    bool put(const K& key, const V& val){
+        if constexpr( usesEngine ){
+            auto timer = metrics.time(CacheMetrics::Put);
+            if( !weigher ){
+                timer.count(CacheMetrics::Puts);
+                if( storage.insertOrAssign(key, val) && storage.size() > capacity ){
+                    timer.count(CacheMetrics::Evictions);
+                    storage.evict();
+                }
+                return true;
+            }
+            size_t weight = weigher(key, val);
+            if( rejectOversized(key, weight) ){
+                return false;
+            }
+            timer.count(CacheMetrics::Puts);
+            storage.insertOrAssign(key, val);
+            recordWeight(key, weight);
+            // The new key is the engine's most recent entry, so it is never its own victim
+            while( totalWeight > capacity ){
+                evictOne();
+            }
+            return true;
+        } else {
+            return insert(key, val, [&]{ storage.add(key, val); });
+        }
+    }
+
+    // Stores the value with its own TTL; needs a storage that supports expiry
+    bool put(const K& key, const V& val, milliseconds ttl){
+        if constexpr( usesEngine ){
+            throw logic_error("Cache engines do not support per-key TTL");
+        } else {
+            return insert(key, val, [&]{ storage.add(key, val, ttl); });
+        }
+    }
+
+    V get(const K& key){
+        const V* val = getPtr(key);
+        if( !val ){
+            throw runtime_error("Key Not Found in the Cache");
+        }
+        return *val;
+    }
+
+    V get(const HashedKey<K>& key){
+        const V* val = getPtr(key);
+        if( !val ){
+            throw runtime_error("Key Not Found in the Cache");
+        }
+        return *val;
+    }
+
+    // Marks the key as accessed and returns a pointer to its value without copying it,
+    // or nullptr on a miss. The pointer stays valid until the next put on this cache.
+    const V* getPtr(const K& key){
+        return lookup(key);
+    }
+
+    // Lookup by view (e.g. a string_view for string keys) with the hash computed once: no K
+    // is built on a hit and the maps along the way reuse the hash instead of rehashing
+    const V* getPtr(const HashedKey<K>& key){
+        return lookup(key);
+    }
+
+    // getPtr for a second look at a key whose lookup was just recorded, e.g. after a miss
+    // under a weaker lock, so the same request is not counted or sampled twice
+    const V* recheck(const K& key){
+        return findResident(key);
+    }
+
+    const V* recheck(const HashedKey<K>& key){
+        return findResident(key);
+    }
+
+    optional<V> tryGet(const K& key){
+        const V* val = getPtr(key);
+        return val ? optional<V>(*val) : nullopt;
+    }
+
+    optional<V> tryGet(const HashedKey<K>& key){
+        const V* val = getPtr(key);
+        return val ? optional<V>(*val) : nullopt;
+    }
+
+    V getOrDefault(const K& key, const V& defaultValue){
+        const V* val = getPtr(key);
+        return val ? *val : defaultValue;
+    }
+
+    void prefetch(const K& key) const{
+        if constexpr( requires{ storage.prefetch(key); } ){
+            storage.prefetch(key);
+        }
+        if constexpr( requires{ policy.prefetch(key); } ){
+            policy.prefetch(key);
+        }
+    }
+
+    void prefetch(const HashedKey<K>& key) const{
+        if constexpr( requires{ storage.prefetch(key); } ){
+            storage.prefetch(key);
+        }
+        if constexpr( requires{ policy.prefetch(key); } ){
+            policy.prefetch(key);
+        }
+    }
+
+    // Looks up every key, prefetching all of them before the first lookup. Each key is hashed
+    // once, for the prefetch and the lookup. Results are in input order.
+    vector<optional<V>> multiGet(span<const K> keys){
+        vector<HashedKey<K>> hashed;
+        hashed.reserve(keys.size());
+        for( const K& key : keys ){
+            hashed.emplace_back(key);
+            prefetch(hashed.back());
+        }
+        vector<optional<V>> results;
+        results.reserve(keys.size());
+        for( const HashedKey<K>& key : hashed ){
+            const V* val = getPtr(key);
+            results.push_back(val ? optional<V>(*val) : nullopt);
+        }
+        return results;
+    }
+
+    // Returns how many entries were stored (weighted caches reject oversized values)
+    size_t multiPut(span<const pair<K, V>> entries){
+        for( const auto& entry : entries ){
+            prefetch(entry.first);
+        }
+        size_t stored = 0;
+        for( const auto& [key, val] : entries ){
+            stored += put(key, val);
+        }
+        return stored;
+    }
+
+    // Called with every entry evicted for capacity, just before it is dropped, e.g. to spill it
+    // to an MmapStorage. Expired and explicitly removed entries are not reported.
+    void setEvictionListener(EvictionListener listener){
+        if constexpr( usesEngine ){
+            throw logic_error("Cache engines do not report evicted values");
+        } else {
+            evictionListener = move(listener);
+        }
+    }
+
+    // Every lookup from now on is also recorded by the sampler (nullptr detaches it). A sampler
+    // may be shared by several caches, e.g. the shards of a ShardedCache.
+    void setMissRatioSampler(shared_ptr<MissRatioCurveSampler<K>> sampler){
+        missRatioSampler = move(sampler);
+    }
+
+    // Copies the entries in eviction order, with the policy's frequency hints
+    CacheSnapshot<K, V> captureSnapshot(){
+        CacheSnapshot<K, V> snapshot;
+        snapshot.reserve(size());
+        if constexpr( usesEngine ){
+            storage.forEachInEvictionOrder([&](const K& key, const V& val){ snapshot.add(key, val, 0); });
+        } else {
+            // Collect the order first: a lookup may expire a key and change the policy mid-walk
+            vector<pair<K, uint8_t>> order;
+            order.reserve(size());
+            policy.forEachInEvictionOrder([&](const K& key, uint8_t frequency){ order.emplace_back(key, frequency); });
+            for( auto& [key, frequency] : order ){
+                if( V* val = storage.find(key) ){
+                    snapshot.add(key, *val, frequency);
+                }
+            }
+        }
+        return snapshot;
+    }
+
+    // Rebuilds an empty cache in bulk: the storage is sized once and filled directly and the
+    // policy restores its order from the whole key list, with no per-key put. If the snapshot
+    // holds more than fits, its coldest entries are skipped. The source is a CacheSnapshot or a
+    // SnapshotReader, which decodes each value straight from the file into storage.
+    template<typename Snapshot>
+    void restoreSnapshot(const Snapshot& snapshot){
+        if( size() != 0 ){
+            throw logic_error("A snapshot can only be restored into an empty cache");
+        }
+        size_t first = snapshot.size();
+        size_t used = 0;
+        while( first > 0 ){
+            size_t weight = weigher ? weigher(snapshot.keys[first - 1], snapshot.value(first - 1)) : 1;
+            if( used + weight > capacity ) break;
+            used += weight;
+            first--;
+        }
+        size_t count = snapshot.size() - first;
+        storage.reserve(count + 1);
+        for( size_t i = first; i < snapshot.size(); i++ ){
+            decltype(auto) val = snapshot.value(i);
+            if constexpr( usesEngine ){
+                storage.insertOrAssign(snapshot.keys[i], val);
+            } else {
+                storage.add(snapshot.keys[i], val);
+            }
+            if( weigher ){
+                recordWeight(snapshot.keys[i], weigher(snapshot.keys[i], val));
+            }
+        }
+        if constexpr( !usesEngine ){
+            policy.restore(span<const K>(snapshot.keys).subspan(first), span<const uint8_t>(snapshot.frequencies).subspan(first));
+        }
+    }
+
+    void saveSnapshot(const string& path){
+        writeSnapshot(path, captureSnapshot());
+    }
+
+    void loadSnapshot(const string& path){
+        restoreSnapshot(SnapshotReader<K, V>(path));
+    }
+
+    // Counters and sampled latencies since construction; all zero unless built with CACHE_METRICS
+    CacheStats stats() const{
+        return metrics.stats();
+    }
+
+    // True if getPtr hits may run concurrently under a shared lock
+    bool concurrentHits() const{
+        if constexpr( usesEngine ){
+            return false;
+        } else {
+            return storage.concurrentReads() && policy.concurrentHits();
+        }
+    }
+
+    // Returns true if the key was resident
+    bool remove(const K& key){
+        forgetWeight(key);
+        if constexpr( usesEngine ){
+            bool resident = storage.find(key) != nullptr;
+            storage.remove(key);
+            return resident;
+        } else {
+            if( !storage.exists(key) ) return false;
+            storage.remove(key);
+            policy.keyRemoved(key);
+            return true;
+        }
+    }
+
+    size_t size() const{
+        return storage.size();
+    }
+
+    // Total weight of the resident entries (e.g. bytes); equals size() without a weigher
+    size_t weightedSize() const{
+        return weigher ? totalWeight : size();
+    }
+};
+
+// Adapters that let StaticCache hold the runtime-polymorphic interfaces
+template<typename T, typename V>
+class DynamicStorage{
+private:
+    unique_ptr<IStorage<T, V>> impl;
+
+public:
+    DynamicStorage(unique_ptr<IStorage<T, V>> _impl) : impl(move(_impl)){}
+
+    V* find(const T& key){ return impl->find(key); }
+    V* find(const HashedKey<T>& key){ return impl->find(key); }
+    void add(const T& key, const V& val){ impl->add(key, val); }
+    void add(const T& key, const V& val, milliseconds ttl){ impl->add(key, val, ttl); }
+    void remove(const T& key){ impl->remove(key); }
+    bool exists(const T& key){ return impl->exists(key); }
+    size_t size() const{ return impl->size(); }
+    void setExpirationListener(function<void(const T&)> listener){ impl->setExpirationListener(move(listener)); }
+    bool concurrentReads() const{ return impl->concurrentReads(); }
+    void prefetch(const T& key) const{ impl->prefetch(key); }
+    void prefetch(const HashedKey<T>& key) const{ impl->prefetch(key); }
+    void reserve(size_t entries){ impl->reserve(entries); }
+};
+
+template<typename T>
+class DynamicEvictionPolicy{
+private:
+    unique_ptr<IEvictionPolicy<T>> impl;
+
+public:
+    DynamicEvictionPolicy(unique_ptr<IEvictionPolicy<T>> _impl) : impl(move(_impl)){}
+
+    void keyAccessed(const T& key){ impl->keyAccessed(key); }
+    void keyAccessed(const HashedKey<T>& key){ impl->keyAccessed(key); }
+    void keyMissed(const T& key){ impl->keyMissed(key); }
+    void keyRemoved(const T& key){ impl->keyRemoved(key); }
+    T evict(){ return impl->evict(); }
+    bool concurrentHits() const{ return impl->concurrentHits(); }
+    void prefetch(const T& key) const{ impl->prefetch(key); }
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const{ impl->forEachInEvictionOrder(visit); }
+    void restore(span<const T> keys, span<const uint8_t> frequencies){ impl->restore(keys, frequencies); }
+};
+
+template<typename T, typename V>
+class DynamicEngine{
+private:
+    unique_ptr<ICacheEngine<T, V>> impl;
+
+public:
+    DynamicEngine(unique_ptr<ICacheEngine<T, V>> _impl) : impl(move(_impl)){}
+
+    bool insertOrAssign(const T& key, const V& val){ return impl->insertOrAssign(key, val); }
+    V* find(const T& key){ return impl->find(key); }
+    V* find(const HashedKey<T>& key){ return impl->find(key); }
+    T evict(){ return impl->evict(); }
+    void remove(const T& key){ impl->remove(key); }
+    size_t size() const{ return impl->size(); }
+    void prefetch(const T& key) const{ impl->prefetch(key); }
+    void forEachInEvictionOrder(const function<void(const T&, const V&)>& visit) const{ impl->forEachInEvictionOrder(visit); }
+    void reserve(size_t entries){ impl->reserve(entries); }
+};
+
+// Runtime-polymorphic cache: storage, policy or engine are chosen at runtime through the
+// IStorage / IEvictionPolicy / ICacheEngine interfaces. A thin adapter over StaticCache.
+template<typename T, typename V>
+class Cache{
+public:
+    using Weigher = function<size_t(const T&, const V&)>;
+    using EvictionListener = function<void(const T&, const V&)>;
+
+private:
+    using PolicyCore = StaticCache<T, V, DynamicStorage<T, V>, DynamicEvictionPolicy<T>>;
+    using EngineCore = StaticCache<T, V, DynamicEngine<T, V>>;
+
+    optional<PolicyCore> core;
+    optional<EngineCore> engineCore;
+
+    template<typename F>
+    decltype(auto) dispatch(F call){
+        return core ? call(*core) : call(*engineCore);
+    }
+
+    template<typename F>
+    decltype(auto) dispatch(F call) const{
+        return core ? call(*core) : call(*engineCore);
+    }
+
+public:
+    Cache(unique_ptr<IStorage<T, V>> _storage, unique_ptr<IEvictionPolicy<T>> _policy, size_t _capacity){
+        core.emplace(_capacity, DynamicStorage<T, V>(move(_storage)), DynamicEvictionPolicy<T>(move(_policy)));
+    }
+
+    Cache(unique_ptr<ICacheEngine<T, V>> _engine, size_t _capacity){
+        engineCore.emplace(_capacity, DynamicEngine<T, V>(move(_engine)));
+    }
+
+    // Byte-weighted caches: entries are evicted until the total weight fits in maxWeight
+    Cache(unique_ptr<IStorage<T, V>> _storage, unique_ptr<IEvictionPolicy<T>> _policy, size_t maxWeight, Weigher weigher){
+        core.emplace(maxWeight, move(weigher), DynamicStorage<T, V>(move(_storage)), DynamicEvictionPolicy<T>(move(_policy)));
+    }
+
+    Cache(unique_ptr<ICacheEngine<T, V>> _engine, size_t maxWeight, Weigher weigher){
+        engineCore.emplace(maxWeight, move(weigher), DynamicEngine<T, V>(move(_engine)));
+    }
+
+    Cache(Cache&&) = delete;
+    Cache& operator=(Cache&&) = delete;
+
+    bool put(const T& key, const V& val){ return dispatch([&](auto& c){ return c.put(key, val); }); }
+    bool put(const T& key, const V& val, milliseconds ttl){ return dispatch([&](auto& c){ return c.put(key, val, ttl); }); }
+    V get(const T& key){ return dispatch([&](auto& c){ return c.get(key); }); }
+    V get(const HashedKey<T>& key){ return dispatch([&](auto& c){ return c.get(key); }); }
+    const V* getPtr(const T& key){ return dispatch([&](auto& c){ return c.getPtr(key); }); }
+    const V* getPtr(const HashedKey<T>& key){ return dispatch([&](auto& c){ return c.getPtr(key); }); }
+    const V* recheck(const T& key){ return dispatch([&](auto& c){ return c.recheck(key); }); }
+    const V* recheck(const HashedKey<T>& key){ return dispatch([&](auto& c){ return c.recheck(key); }); }
+    optional<V> tryGet(const T& key){ return dispatch([&](auto& c){ return c.tryGet(key); }); }
+    optional<V> tryGet(const HashedKey<T>& key){ return dispatch([&](auto& c){ return c.tryGet(key); }); }
+    V getOrDefault(const T& key, const V& defaultValue){ return dispatch([&](auto& c){ return c.getOrDefault(key, defaultValue); }); }
+    void prefetch(const T& key) const{ dispatch([&](auto& c){ c.prefetch(key); }); }
+    void prefetch(const HashedKey<T>& key) const{ dispatch([&](auto& c){ c.prefetch(key); }); }
+    vector<optional<V>> multiGet(span<const T> keys){ return dispatch([&](auto& c){ return c.multiGet(keys); }); }
+    size_t multiPut(span<const pair<T, V>> entries){ return dispatch([&](auto& c){ return c.multiPut(entries); }); }
+    bool remove(const T& key){ return dispatch([&](auto& c){ return c.remove(key); }); }
+    void setEvictionListener(EvictionListener listener){ dispatch([&](auto& c){ c.setEvictionListener(move(listener)); }); }
+    void setMissRatioSampler(shared_ptr<MissRatioCurveSampler<T>> sampler){ dispatch([&](auto& c){ c.setMissRatioSampler(move(sampler)); }); }
+    CacheSnapshot<T, V> captureSnapshot(){ return dispatch([](auto& c){ return c.captureSnapshot(); }); }
+    template<typename Snapshot>
+    void restoreSnapshot(const Snapshot& snapshot){ dispatch([&](auto& c){ c.restoreSnapshot(snapshot); }); }
+    void saveSnapshot(const string& path){ dispatch([&](auto& c){ c.saveSnapshot(path); }); }
+    void loadSnapshot(const string& path){ dispatch([&](auto& c){ c.loadSnapshot(path); }); }
+    CacheStats stats() const{ return dispatch([](auto& c){ return c.stats(); }); }
+    bool concurrentHits() const{ return dispatch([](auto& c){ return c.concurrentHits(); }); }
+    size_t size() const{ return dispatch([](auto& c){ return c.size(); }); }
+    size_t weightedSize() const{ return dispatch([](auto& c){ return c.weightedSize(); }); }
+};
+
+
+// Thread-safe cache that hashes keys into independent shards.
+// Every shard owns its own storage, eviction policy and lock, so capacity and
+// eviction are enforced per shard and threads touching different shards never contend.
+// When the storage and policy allow concurrent hits (e.g. HashMapStorage + CLOCK), reads
+// take the shard lock in shared mode and no longer serialize each other.
+// getOrLoad / getOrLoadAsync make it a read-through cache: concurrent misses on one key
+// share a single backend load instead of each calling the loader.
+template<typename T, typename V>
+class ShardedCache{
+private:
+    // A backend load in progress; callers that miss on the same key wait on `result`
+    struct Load{
+        promise<V> completion;
+        shared_future<V> result = completion.get_future().share();
+    };
+
+    struct alignas(64) Shard{
+        shared_mutex lock;
+        Cache<T, V> cache;
+        bool sharedReads;
+        unordered_map<T, shared_ptr<Load>> inFlight;
+
+        Shard(unique_ptr<IStorage<T, V>> _storage, unique_ptr<IEvictionPolicy<T>> _policy, size_t _capacity) : cache(move(_storage), move(_policy), _capacity){
+            sharedReads = cache.concurrentHits();
+        }
+
+        Shard(unique_ptr<IStorage<T, V>> _storage, unique_ptr<IEvictionPolicy<T>> _policy, size_t maxWeight, typename Cache<T, V>::Weigher weigher) : cache(move(_storage), move(_policy), maxWeight, move(weigher)){
+            sharedReads = cache.concurrentHits();
+        }
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    hash<T> hasher;
+    // Counts what happens outside the shard caches, i.e. failed loads
+    [[no_unique_address]] Metrics metrics;
+
+    size_t shardIndexOfHash(size_t hash){
+        // std::hash is the identity for integers, so mix the bits before picking a shard
+        uint64_t h = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+        return (h >> 32) % shards.size();
+    }
+
+    size_t shardIndex(const T& key){
+        return shardIndexOfHash(hasher(key));
+    }
+
+    size_t shardIndex(const HashedKey<T>& key){
+        return shardIndexOfHash(key.hash);
+    }
+
+    template<typename Key>
+    Shard& shardFor(const Key& key){
+        return *shards[shardIndex(key)];
+    }
+
+    // Counting sort of batch positions by the shard of their key's hash: positions of shard s
+    // are order[offsets[s] .. offsets[s + 1])
+    void groupByShard(const vector<size_t>& hashes, vector<uint32_t>& order, vector<uint32_t>& offsets){
+        size_t count = hashes.size();
+        vector<uint32_t> shardOf(count);
+        offsets.assign(shards.size() + 1, 0);
+        for( size_t i = 0; i < count; i++ ){
+            shardOf[i] = static_cast<uint32_t>(shardIndexOfHash(hashes[i]));
+            offsets[shardOf[i] + 1]++;
+        }
+        for( size_t s = 0; s < shards.size(); s++ ){
+            offsets[s + 1] += offsets[s];
+        }
+        order.resize(count);
+        vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for( size_t i = 0; i < count; i++ ){
+            order[next[shardOf[i]]++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // Key is T or HashedKey<T>
+    template<typename Key, typename F>
+    auto read(const Key& key, F lookup){
+        Shard& shard = shardFor(key);
+        if( shard.sharedReads ){
+            shared_lock<shared_mutex> guard(shard.lock);
+            return lookup(shard.cache);
+        }
+        unique_lock<shared_mutex> guard(shard.lock);
+        return lookup(shard.cache);
+    }
+
+    // Returns the value if it is cached, otherwise the load to wait on. `started` tells the
+    // caller it registered a new load and must run it and call finishLoad.
+    variant<V, shared_ptr<Load>> joinOrStartLoad(Shard& shard, const T& key, bool& started){
+        lock_guard<shared_mutex> guard(shard.lock);
+        if( const V* val = shard.cache.recheck(key) ){
+            return *val;
+        }
+        auto [it, inserted] = shard.inFlight.try_emplace(key);
+        if( inserted ){
+            it->second = make_shared<Load>();
+        }
+        started = inserted;
+        return it->second;
+    }
+
+    // A put or remove during the load drops its registration, so a stale loaded value is
+    // handed to the waiters but not cached. Failed loads are never cached.
+    void finishLoad(Shard& shard, const T& key, const shared_ptr<Load>& load, const V* val, exception_ptr error){
+        {
+            lock_guard<shared_mutex> guard(shard.lock);
+            auto it = shard.inFlight.find(key);
+            if( it != shard.inFlight.end() && it->second == load ){
+                shard.inFlight.erase(it);
+                if( val ){
+                    shard.cache.put(key, *val);
+                }
+            }
+        }
+        if( val ){
+            load->completion.set_value(*val);
+        } else {
+            metrics.count(CacheMetrics::LoadFailures);
+            load->completion.set_exception(error);
+        }
+    }
+
+public:
+    using StorageFactory = function<unique_ptr<IStorage<T, V>>()>;
+    using PolicyFactory = function<unique_ptr<IEvictionPolicy<T>>()>;
+
+    ShardedCache(size_t shardCount, size_t capacity, StorageFactory storageFactory, PolicyFactory policyFactory){
+        if( shardCount == 0 || capacity < shardCount ){
+            throw invalid_argument("Capacity must allow at least one entry per shard");
+        }
+        size_t perShard = (capacity + shardCount - 1) / shardCount;
+        for( size_t i = 0; i < shardCount; i++ ){
+            shards.push_back(make_unique<Shard>(storageFactory(), policyFactory(), perShard));
+        }
+    }
+
+    // Byte-weighted variant: every shard gets an equal slice of maxWeight
+    ShardedCache(size_t shardCount, size_t maxWeight, typename Cache<T, V>::Weigher weigher, StorageFactory storageFactory, PolicyFactory policyFactory){
+        if( shardCount == 0 || maxWeight < shardCount ){
+            throw invalid_argument("Weight budget must allow at least one unit per shard");
+        }
+        for( size_t i = 0; i < shardCount; i++ ){
+            shards.push_back(make_unique<Shard>(storageFactory(), policyFactory(), maxWeight / shardCount, weigher));
+        }
+    }
+
+    bool put(const T& key, const V& val){
+        Shard& shard = shardFor(key);
+        lock_guard<shared_mutex> guard(shard.lock);
+        shard.inFlight.erase(key);
+        return shard.cache.put(key, val);
+    }
+
+    bool put(const T& key, const V& val, milliseconds ttl){
+        Shard& shard = shardFor(key);
+        lock_guard<shared_mutex> guard(shard.lock);
+        shard.inFlight.erase(key);
+        return shard.cache.put(key, val, ttl);
+    }
+
+    V get(const T& key){
+        return read(key, [&](Cache<T, V>& cache){ return cache.get(key); });
+    }
+
+    V get(const HashedKey<T>& key){
+        return read(key, [&](Cache<T, V>& cache){ return cache.get(key); });
+    }
+
+    // Values are copied out under the shard lock, so no pointer variant is offered here
+    optional<V> tryGet(const T& key){
+        return read(key, [&](Cache<T, V>& cache){ return cache.tryGet(key); });
+    }
+
+    // The one hash picks the shard and serves the shard's lookup
+    optional<V> tryGet(const HashedKey<T>& key){
+        return read(key, [&](Cache<T, V>& cache){ return cache.tryGet(key); });
+    }
+
+    V getOrDefault(const T& key, const V& defaultValue){
+        return read(key, [&](Cache<T, V>& cache){ return cache.getOrDefault(key, defaultValue); });
+    }
+
+    // Read-through lookup: on a miss, exactly one caller runs loader(key) while concurrent
+    // callers for the same key wait for its result. The loader runs without the shard lock
+    // held; if it throws, every waiter gets the exception and nothing is cached.
+    template<typename Loader>
+    V getOrLoad(const T& key, Loader&& loader){
+        if( optional<V> cached = tryGet(key) ){
+            return move(*cached);
+        }
+        Shard& shard = shardFor(key);
+        bool started = false;
+        auto state = joinOrStartLoad(shard, key, started);
+        if( V* val = get_if<V>(&state) ){
+            return move(*val);
+        }
+        shared_ptr<Load> load = std::get<shared_ptr<Load>>(state);
+        if( started ){
+            try{
+                V val = loader(key);
+                finishLoad(shard, key, load, &val, nullptr);
+            } catch( ... ){
+                finishLoad(shard, key, load, nullptr, current_exception());
+            }
+        }
+        return load->result.get();
+    }
+
+    // Asynchronous read-through: misses are queued on the batch loader, which coalesces them
+    // into loadAll calls. The loader must be destroyed before this cache.
+    shared_future<V> getOrLoadAsync(const T& key, BatchLoader<T, V>& loader){
+        if( optional<V> cached = tryGet(key) ){
+            promise<V> ready;
+            ready.set_value(move(*cached));
+            return ready.get_future().share();
+        }
+        Shard& shard = shardFor(key);
+        bool started = false;
+        auto state = joinOrStartLoad(shard, key, started);
+        if( V* val = get_if<V>(&state) ){
+            promise<V> ready;
+            ready.set_value(move(*val));
+            return ready.get_future().share();
+        }
+        shared_ptr<Load> load = std::get<shared_ptr<Load>>(state);
+        if( started ){
+            loader.submit(key, [this, &shard, load](const T& loadedKey, const V* val, exception_ptr error){
+                finishLoad(shard, loadedKey, load, val, error);
+            });
+        }
+        return load->result;
+    }
+
+    // Batched lookup: every key is hashed once up front, and the hash picks its shard and serves
+    // the shard's prefetch and lookup as a HashedKey. Each shard lock is taken once, and the
+    // group's keys are prefetched (by storages that can) before its lookups. Results are in
+    // input order.
+    vector<optional<V>> multiGet(span<const T> keys){
+        vector<size_t> hashes(keys.size());
+        for( size_t i = 0; i < keys.size(); i++ ){
+            hashes[i] = hasher(keys[i]);
+        }
+        vector<uint32_t> order, offsets;
+        groupByShard(hashes, order, offsets);
+        vector<optional<V>> results(keys.size());
+        for( size_t s = 0; s < shards.size(); s++ ){
+            if( offsets[s] == offsets[s + 1] ) continue;
+            Shard& shard = *shards[s];
+            auto lookupAll = [&]{
+                for( uint32_t i = offsets[s]; i < offsets[s + 1]; i++ ){
+                    shard.cache.prefetch(HashedKey<T>(keys[order[i]], hashes[order[i]]));
+                }
+                for( uint32_t i = offsets[s]; i < offsets[s + 1]; i++ ){
+                    if( const V* val = shard.cache.getPtr(HashedKey<T>(keys[order[i]], hashes[order[i]])) ){
+                        results[order[i]] = *val;
+                    }
+                }
+            };
+            if( shard.sharedReads ){
+                shared_lock<shared_mutex> guard(shard.lock);
+                lookupAll();
+            } else {
+                unique_lock<shared_mutex> guard(shard.lock);
+                lookupAll();
+            }
+        }
+        return results;
+    }
+
+    // Batched put with one lock acquisition per shard; entries for the same key are applied
+    // in input order. Returns how many entries were stored. The up-front hash serves grouping
+    // and prefetching; put itself still hashes the key.
+    size_t multiPut(span<const pair<T, V>> entries){
+        vector<size_t> hashes(entries.size());
+        for( size_t i = 0; i < entries.size(); i++ ){
+            hashes[i] = hasher(entries[i].first);
+        }
+        vector<uint32_t> order, offsets;
+        groupByShard(hashes, order, offsets);
+        size_t stored = 0;
+        for( size_t s = 0; s < shards.size(); s++ ){
+            if( offsets[s] == offsets[s + 1] ) continue;
+            Shard& shard = *shards[s];
+            lock_guard<shared_mutex> guard(shard.lock);
+            for( uint32_t i = offsets[s]; i < offsets[s + 1]; i++ ){
+                shard.cache.prefetch(HashedKey<T>(entries[order[i]].first, hashes[order[i]]));
+            }
+            for( uint32_t i = offsets[s]; i < offsets[s + 1]; i++ ){
+                const auto& [key, val] = entries[order[i]];
+                shard.inFlight.erase(key);
+                stored += shard.cache.put(key, val);
+            }
+        }
+        return stored;
+    }
+
+    // Returns true if the key was resident
+    bool remove(const T& key){
+        Shard& shard = shardFor(key);
+        lock_guard<shared_mutex> guard(shard.lock);
+        shard.inFlight.erase(key);
+        return shard.cache.remove(key);
+    }
+
+    // Writes every shard's entries in its eviction order. Each shard is locked only while its
+    // entries are copied out, so the rest of the cache keeps serving.
+    void saveSnapshot(const string& path){
+        SnapshotWriter writer(path);
+        for( auto& shard : shards ){
+            CacheSnapshot<T, V> captured;
+            {
+                lock_guard<shared_mutex> guard(shard->lock);
+                captured = shard->cache.captureSnapshot();
+            }
+            writer.append(captured);
+        }
+        writer.close();
+    }
+
+    // Loads a snapshot into an empty cache. Entries are split by shard first, so each shard
+    // rebuilds in bulk and keeps the relative order its entries had in the file. Values are
+    // decoded from the file straight into each shard's storage.
+    void loadSnapshot(const string& path){
+        vector<SnapshotReader<T, V>> parts = SnapshotReader<T, V>(path).split(shards.size(), [&](const T& key){ return shardIndex(key); });
+        for( size_t s = 0; s < shards.size(); s++ ){
+            lock_guard<shared_mutex> guard(shards[s]->lock);
+            shards[s]->cache.restoreSnapshot(parts[s]);
+        }
+    }
+
+    size_t shardCount() const{
+        return shards.size();
+    }
+
+    // One sampler records the lookups of every shard, so its curve is for the whole cache
+    void setMissRatioSampler(shared_ptr<MissRatioCurveSampler<T>> sampler){
+        for( auto& shard : shards ){
+            lock_guard<shared_mutex> guard(shard->lock);
+            shard->cache.setMissRatioSampler(sampler);
+        }
+    }
+
+    // Sum over the shards; counters are read without the shard locks
+    CacheStats stats() const{
+        CacheStats total = metrics.stats();
+        for( auto& shard : shards ){
+            total += shard->cache.stats();
+        }
+        return total;
+    }
+
+    size_t weightedSize(){
+        size_t total = 0;
+        for( auto& shard : shards ){
+            shared_lock<shared_mutex> guard(shard->lock);
+            total += shard->cache.weightedSize();
+        }
+        return total;
+    }
+};
+
+
+// Thread-safe cache for read-mostly workloads whose reads take no locks and write no shared
+// memory. Each shard is a fixed-size array of bucket chains built from immutable nodes:
+// writers (serialized per shard) publish a new node instead of changing one in place, and
+// retire replaced or evicted nodes to an EpochDomain, which frees them only once no reader
+// can still be looking at them. Eviction is CLOCK. A hit sets nothing shared: it appends the
+// node to the reading thread's own ring buffer (only while its reference bit is clear, and
+// dropping the record if the ring is full), and writers drain every ring into the reference
+// bits before they reclaim memory or evict.
+template<typename T, typename V>
+class ConcurrentCache{
+private:
+    struct Node{
+        const T key;
+        const V value;
+        atomic<Node*> next{nullptr};
+        atomic<bool> referenced{false};
+        size_t clockSlot = 0;   // position in the shard's clock, guarded by the shard lock
+
+        Node(const T& _key, const V& _value) : key(_key), value(_value){}
+    };
+
+    // Hits recorded by one reader thread. The owner is the only producer; drains are
+    // serialized by maintenanceLock, so head and tail each have a single writer.
+    struct alignas(64) ReadBuffer{
+        static constexpr size_t capacity = 64;
+
+        array<Node*, capacity> nodes{};
+        atomic<size_t> head{0};
+        alignas(64) atomic<size_t> tail{0};
+    };
+
+    struct alignas(64) Shard{
+        mutex lock;
+        unique_ptr<atomic<Node*>[]> buckets;
+        size_t mask;
+        size_t capacity;
+        vector<Node*> clock;
+        size_t hand = 0;
+        RetireList<Node> retired;
+
+        Shard(size_t _capacity) : mask(bit_ceil(_capacity) - 1), capacity(_capacity){
+            buckets = make_unique<atomic<Node*>[]>(mask + 1);
+            clock.reserve(_capacity);
+        }
+
+        ~Shard(){
+            for( size_t i = 0; i <= mask; i++ ){
+                for( Node* node = buckets[i].load(memory_order_relaxed); node; ){
+                    delete exchange(node, node->next.load(memory_order_relaxed));
+                }
+            }
+        }
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    EpochDomain epochs;
+    unique_ptr<ReadBuffer[]> readBuffers = make_unique<ReadBuffer[]>(maxEpochThreads);
+    mutex maintenanceLock;
+    // Epoch of the latest advance whose buffered hits have all been drained; nodes retired two
+    // epochs before it appear in no read buffer and may be freed
+    atomic<uint64_t> drainedEpoch{1};
+    hash<T> hasher;
+
+    size_t hashOf(const T& key) const{
+        // std::hash is the identity for integers, so mix the bits before splitting them
+        uint64_t h = static_cast<uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    Shard& shardFor(size_t h){
+        return *shards[(h >> 32) % shards.size()];
+    }
+
+    // Readers load with sequential consistency so that a node they reach was unlinked no
+    // earlier than the epoch they pinned
+    static Node* findIn(const Shard& shard, const T& key, size_t h){
+        for( Node* node = shard.buckets[h & shard.mask].load(memory_order_seq_cst); node; node = node->next.load(memory_order_seq_cst) ){
+            if( node->key == key ){
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    // The link that points at `node`; writers only, under the shard lock
+    static atomic<Node*>* linkTo(Shard& shard, Node* node, size_t h){
+        atomic<Node*>* link = &shard.buckets[h & shard.mask];
+        while( link->load(memory_order_relaxed) != node ){
+            link = &link->load(memory_order_relaxed)->next;
+        }
+        return link;
+    }
+
+    void recordHit(Node* node){
+        if( node->referenced.load(memory_order_relaxed) ){
+            return;
+        }
+        ReadBuffer& buffer = readBuffers[EpochThreadRegistry::index()];
+        size_t head = buffer.head.load(memory_order_relaxed);
+        if( head - buffer.tail.load(memory_order_acquire) < ReadBuffer::capacity ){
+            buffer.nodes[head % ReadBuffer::capacity] = node;
+            buffer.head.store(head + 1, memory_order_release);
+        }
+    }
+
+    // Advances the epoch, then moves every buffered hit into its node's reference bit.
+    // Skipped if another writer is already at it.
+    void drainReadBuffers(){
+        unique_lock<mutex> guard(maintenanceLock, try_to_lock);
+        if( !guard ){
+            return;
+        }
+        uint64_t epoch = epochs.tryAdvance();
+        for( size_t i = 0, threads = EpochThreadRegistry::count(); i < threads; i++ ){
+            ReadBuffer& buffer = readBuffers[i];
+            size_t head = buffer.head.load(memory_order_acquire);
+            for( size_t tail = buffer.tail.load(memory_order_relaxed); tail != head; tail++ ){
+                buffer.nodes[tail % ReadBuffer::capacity]->referenced.store(true, memory_order_relaxed);
+            }
+            buffer.tail.store(head, memory_order_release);
+        }
+        drainedEpoch.store(epoch, memory_order_release);
+    }
+
+    void retire(Shard& shard, Node* node){
+        shard.retired.retire(node, epochs.current());
+    }
+
+    void detachFromClock(Shard& shard, Node* node){
+        Node* last = shard.clock.back();
+        shard.clock[node->clockSlot] = last;
+        last->clockSlot = node->clockSlot;
+        shard.clock.pop_back();
+        if( shard.hand >= shard.clock.size() ){
+            shard.hand = 0;
+        }
+    }
+
+    void unlink(Shard& shard, Node* node, size_t h){
+        linkTo(shard, node, h)->store(node->next.load(memory_order_relaxed), memory_order_seq_cst);
+        detachFromClock(shard, node);
+        retire(shard, node);
+    }
+
+    void evictOne(Shard& shard){
+        while( true ){
+            Node* node = shard.clock[shard.hand];
+            if( node->referenced.exchange(false, memory_order_relaxed) ){
+                shard.hand = (shard.hand + 1) % shard.clock.size();
+                continue;
+            }
+            unlink(shard, node, hashOf(node->key));
+            return;
+        }
+    }
+
+public:
+    ConcurrentCache(size_t shardCount, size_t capacity){
+        if( shardCount == 0 || capacity < shardCount ){
+            throw invalid_argument("Capacity must allow at least one entry per shard");
+        }
+        size_t perShard = (capacity + shardCount - 1) / shardCount;
+        for( size_t i = 0; i < shardCount; i++ ){
+            shards.push_back(make_unique<Shard>(perShard));
+        }
+    }
+
+    // Every reader and writer must have finished before the cache is destroyed
+    ConcurrentCache(ConcurrentCache&&) = delete;
+    ConcurrentCache& operator=(ConcurrentCache&&) = delete;
+
+    void put(const T& key, const V& val){
+        size_t h = hashOf(key);
+        Shard& shard = shardFor(h);
+        lock_guard<mutex> guard(shard.lock);
+        Node* fresh = new Node(key, val);
+        if( Node* old = findIn(shard, key, h) ){
+            fresh->next.store(old->next.load(memory_order_relaxed), memory_order_relaxed);
+            fresh->referenced.store(true, memory_order_relaxed);
+            fresh->clockSlot = old->clockSlot;
+            shard.clock[old->clockSlot] = fresh;
+            linkTo(shard, old, h)->store(fresh, memory_order_seq_cst);
+            retire(shard, old);
+        } else {
+            if( shard.clock.size() == shard.capacity ){
+                drainReadBuffers();
+                evictOne(shard);
+            }
+            atomic<Node*>& bucket = shard.buckets[h & shard.mask];
+            fresh->next.store(bucket.load(memory_order_relaxed), memory_order_relaxed);
+            fresh->clockSlot = shard.clock.size();
+            shard.clock.push_back(fresh);
+            bucket.store(fresh, memory_order_seq_cst);
+        }
+        drainReadBuffers();
+        shard.retired.reclaim(drainedEpoch.load(memory_order_acquire));
+    }
+
+    // Lock-free: pins the epoch, walks one bucket chain and copies the value out
+    optional<V> tryGet(const T& key){
+        size_t h = hashOf(key);
+        const Shard& shard = shardFor(h);
+        auto pinned = epochs.pin();
+        Node* node = findIn(shard, key, h);
+        if( !node ){
+            return nullopt;
+        }
+        recordHit(node);
+        return node->value;
+    }
+
+    V get(const T& key){
+        optional<V> val = tryGet(key);
+        if( !val ){
+            throw runtime_error("Key Not Found in the Cache");
+        }
+        return move(*val);
+    }
+
+    V getOrDefault(const T& key, const V& defaultValue){
+        optional<V> val = tryGet(key);
+        return val ? move(*val) : defaultValue;
+    }
+
+    void remove(const T& key){
+        size_t h = hashOf(key);
+        Shard& shard = shardFor(h);
+        lock_guard<mutex> guard(shard.lock);
+        if( Node* node = findIn(shard, key, h) ){
+            unlink(shard, node, h);
+        }
+        drainReadBuffers();
+        shard.retired.reclaim(drainedEpoch.load(memory_order_acquire));
+    }
+
+    // Frees whatever retired nodes readers have left behind; writes already do this for their
+    // own shard, so only caches that stop receiving writes need to call it (e.g. from a tick)
+    void reclaimRetired(){
+        for( auto& shard : shards ){
+            lock_guard<mutex> guard(shard->lock);
+            drainReadBuffers();
+            shard->retired.reclaim(drainedEpoch.load(memory_order_acquire));
+        }
+    }
+
+    size_t size(){
+        size_t total = 0;
+        for( auto& shard : shards ){
+            lock_guard<mutex> guard(shard->lock);
+            total += shard->clock.size();
+        }
+        return total;
+    }
+
+    // Replaced or evicted nodes not yet freed, for checking that reclamation keeps up
+    size_t retiredCount(){
+        size_t total = 0;
+        for( auto& shard : shards ){
+            lock_guard<mutex> guard(shard->lock);
+            total += shard->retired.size();
+        }
+        return total;
+    }
+
+    size_t shardCount() const{
+        return shards.size();
+    }
+};
+
+
+// Hit counts of a TieredCache, summed over all threads
+struct TieredCacheStats{
+    size_t l1Hits = 0;
+    size_t l2Hits = 0;
+    size_t misses = 0;
+
+    size_t lookups() const{
+        return l1Hits + l2Hits + misses;
+    }
+
+    double l1HitRatio() const{
+        return lookups() ? static_cast<double>(l1Hits) / lookups() : 0;
+    }
+
+    // Among the lookups that reached L2
+    double l2HitRatio() const{
+        size_t l2Lookups = l2Hits + misses;
+        return l2Lookups ? static_cast<double>(l2Hits) / l2Lookups : 0;
+    }
+};
+
+// Two-level cache: a small direct-mapped L1 per thread in front of a shared, thread-safe L2
+// (ShardedCache or ConcurrentCache). An L1 hit touches only the thread's own table and one
+// read-mostly generation counter. put and remove write L2 and then bump the generation of the
+// key's stripe; an L1 entry filled under an older generation is dropped when it is checked,
+// so a write through this cache is hidden by a stale L1 entry for at most revalidateAfter - 1
+// hits per thread (none with the default of 1). Writes made to L2 directly bypass the
+// generations and stay invisible to L1 entries until they are evicted from L1.
+template<typename T, typename V, typename Shared = ShardedCache<T, V>>
+class TieredCache{
+private:
+    struct Entry{
+        T key;
+        V value;
+        uint64_t generation = 0;
+        size_t hitsSinceCheck = 0;
+        bool valid = false;
+    };
+
+    // Only the owning thread writes an L1; counters are atomics so stats() can read them
+    struct alignas(64) L1{
+        vector<Entry> entries;
+        atomic<size_t> l1Hits{0};
+        atomic<size_t> l2Hits{0};
+        atomic<size_t> misses{0};
+
+        L1(size_t slots) : entries(slots){}
+    };
+
+    unique_ptr<Shared> shared;
+    // Allocated by their owning thread on first use, indexed by EpochThreadRegistry::index()
+    unique_ptr<atomic<L1*>[]> l1s = make_unique<atomic<L1*>[]>(maxEpochThreads);
+    unique_ptr<atomic<uint64_t>[]> generations;
+    size_t l1Mask;
+    size_t stripeMask;
+    size_t revalidateAfter;
+    hash<T> hasher;
+
+    size_t hashOf(const T& key) const{
+        // std::hash is the identity for integers, so mix the bits before splitting them
+        uint64_t h = static_cast<uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    atomic<uint64_t>& generationOf(size_t h){
+        return generations[(h >> 16) & stripeMask];
+    }
+
+    L1& localL1(){
+        atomic<L1*>& slot = l1s[EpochThreadRegistry::index()];
+        L1* l1 = slot.load(memory_order_relaxed);
+        if( !l1 ){
+            l1 = new L1(l1Mask + 1);
+            slot.store(l1, memory_order_release);
+        }
+        return *l1;
+    }
+
+    static void count(atomic<size_t>& counter){
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+public:
+    // l1Entries and stripes are rounded up to powers of two
+    TieredCache(unique_ptr<Shared> _shared, size_t l1Entries = 64, size_t _revalidateAfter = 1, size_t stripes = 1024)
+        : shared(move(_shared)), l1Mask(bit_ceil(max<size_t>(l1Entries, 1)) - 1), stripeMask(bit_ceil(max<size_t>(stripes, 1)) - 1), revalidateAfter(max<size_t>(_revalidateAfter, 1)){
+        generations = make_unique<atomic<uint64_t>[]>(stripeMask + 1);
+    }
+
+    ~TieredCache(){
+        for( size_t i = 0; i < maxEpochThreads; i++ ){
+            delete l1s[i].load(memory_order_relaxed);
+        }
+    }
+
+    TieredCache(TieredCache&&) = delete;
+    TieredCache& operator=(TieredCache&&) = delete;
+
+    optional<V> tryGet(const T& key){
+        size_t h = hashOf(key);
+        L1& l1 = localL1();
+        Entry& entry = l1.entries[h & l1Mask];
+        atomic<uint64_t>& generation = generationOf(h);
+        if( entry.valid && entry.key == key ){
+            if( ++entry.hitsSinceCheck < revalidateAfter ){
+                count(l1.l1Hits);
+                return entry.value;
+            }
+            entry.hitsSinceCheck = 0;
+            if( generation.load(memory_order_acquire) == entry.generation ){
+                count(l1.l1Hits);
+                return entry.value;
+            }
+            entry.valid = false;
+        }
+        // Read the generation before L2, so a write landing in between invalidates this fill
+        uint64_t seen = generation.load(memory_order_acquire);
+        optional<V> val = shared->tryGet(key);
+        if( !val ){
+            count(l1.misses);
+            return nullopt;
+        }
+        count(l1.l2Hits);
+        entry.key = key;
+        entry.value = *val;
+        entry.generation = seen;
+        entry.hitsSinceCheck = 0;
+        entry.valid = true;
+        return val;
+    }
+
+    V get(const T& key){
+        optional<V> val = tryGet(key);
+        if( !val ){
+            throw runtime_error("Key Not Found in the Cache");
+        }
+        return move(*val);
+    }
+
+    V getOrDefault(const T& key, const V& defaultValue){
+        optional<V> val = tryGet(key);
+        return val ? move(*val) : defaultValue;
+    }
+
+    void put(const T& key, const V& val){
+        size_t h = hashOf(key);
+        shared->put(key, val);
+        generationOf(h).fetch_add(1, memory_order_release);
+    }
+
+    void remove(const T& key){
+        size_t h = hashOf(key);
+        shared->remove(key);
+        generationOf(h).fetch_add(1, memory_order_release);
+    }
+
+    // The shared L2, e.g. for getOrLoad; writes made through it are not seen by the L1s
+    Shared& l2(){
+        return *shared;
+    }
+
+    // Counters of threads that are still writing are read as of some recent point
+    TieredCacheStats stats() const{
+        TieredCacheStats total;
+        for( size_t i = 0, threads = EpochThreadRegistry::count(); i < threads; i++ ){
+            if( const L1* l1 = l1s[i].load(memory_order_acquire) ){
+                total.l1Hits += l1->l1Hits.load(memory_order_relaxed);
+                total.l2Hits += l1->l2Hits.load(memory_order_relaxed);
+                total.misses += l1->misses.load(memory_order_relaxed);
+            }
+        }
+        return total;
+    }
+};
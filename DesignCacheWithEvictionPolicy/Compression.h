@@ -0,0 +1,405 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "SpillStorage.h"
+#include "Storage.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// LZ77 block codec in the style of LZ4: a block is a run of sequences, each a token byte
+// (literal count in the high nibble, match length - 4 in the low one, 15 meaning "more bytes
+// follow, 255 at a time"), the literals, then a 2-byte little-endian offset back into the
+// output. The last sequence has literals only. Matches are found through a table of the
+// latest position of every hashed 4-byte string, so compression is one pass with no search,
+// and decompression is memcpy of literals and back-references.
+struct LzCodec{
+    static constexpr size_t minMatch = 4;
+    static constexpr size_t maxOffset = 65535;
+    static constexpr int hashBits = 13;
+    // No match starts in the last matchEndGap bytes and the last lastLiterals are literals,
+    // which keeps every 4-byte read of the compressor inside the input
+    static constexpr size_t matchEndGap = 12;
+    static constexpr size_t lastLiterals = 5;
+
+    static uint32_t read32(const char* p){
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t read64(const char* p){
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t hashOf(uint32_t sequence){
+        return (sequence * 2654435761U) >> (32 - hashBits);
+    }
+
+    // Number of equal leading bytes of a and b, at most limit, compared 8 at a time (the first
+    // differing byte is the lowest set one of the xor on a little-endian machine)
+    static size_t commonPrefix(const char* a, const char* b, size_t limit){
+        size_t length = 0;
+        while( length + 8 <= limit ){
+            uint64_t diff = read64(a + length) ^ read64(b + length);
+            if( diff ) return length + countr_zero(diff) / 8;
+            length += 8;
+        }
+        while( length < limit && a[length] == b[length] ){
+            length++;
+        }
+        return length;
+    }
+
+    // Largest compressed size of n bytes: all literals, one extra length byte per 255
+    static size_t bound(size_t n){
+        return n + n / 255 + 16;
+    }
+
+    static char* writeLength(char* out, size_t length){
+        while( length >= 255 ){
+            *out++ = static_cast<char>(255);
+            length -= 255;
+        }
+        *out++ = static_cast<char>(length);
+        return out;
+    }
+
+    // One sequence; matchLength 0 marks the last one
+    static char* writeSequence(char* out, const char* literals, size_t literalCount, size_t offset, size_t matchLength){
+        size_t matchCode = matchLength ? matchLength - minMatch : 0;
+        *out++ = static_cast<char>((min<size_t>(literalCount, 15) << 4) | min<size_t>(matchCode, 15));
+        if( literalCount >= 15 ){
+            out = writeLength(out, literalCount - 15);
+        }
+        memcpy(out, literals, literalCount);
+        out += literalCount;
+        if( matchLength == 0 ) return out;
+        *out++ = static_cast<char>(offset & 0xFF);
+        *out++ = static_cast<char>(offset >> 8);
+        if( matchCode >= 15 ){
+            out = writeLength(out, matchCode - 15);
+        }
+        return out;
+    }
+
+    // Appends the compressed form of src to out
+    static void compress(string_view src, string& out){
+        const char* in = src.data();
+        size_t n = src.size();
+        size_t base = out.size();
+        out.resize(base + bound(n));
+        char* op = out.data() + base;
+        size_t anchor = 0;
+        if( n > matchEndGap ){
+            uint32_t table[1 << hashBits] = {};
+            size_t matchLimit = n - matchEndGap;
+            size_t extendLimit = n - lastLiterals;
+            size_t ip = 1;
+            while( ip < matchLimit ){
+                uint32_t sequence = read32(in + ip);
+                uint32_t& slot = table[hashOf(sequence)];
+                size_t ref = slot;
+                slot = static_cast<uint32_t>(ip);
+                if( ip - ref > maxOffset || read32(in + ref) != sequence ){
+                    // Skip faster through data that keeps missing, e.g. already compressed bytes
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+                size_t length = minMatch + commonPrefix(in + ref + minMatch, in + ip + minMatch, extendLimit - ip - minMatch);
+                while( ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1] ){
+                    ip--;
+                    ref--;
+                    length++;
+                }
+                op = writeSequence(op, in + anchor, ip - anchor, ip - ref, length);
+                ip += length;
+                anchor = ip;
+                if( ip - 2 < matchLimit ){
+                    // Index a position inside the match so the next repeat of it is found
+                    table[hashOf(read32(in + ip - 2))] = static_cast<uint32_t>(ip - 2);
+                }
+            }
+        }
+        op = writeSequence(op, in + anchor, n - anchor, 0, 0);
+        out.resize(op - out.data());
+    }
+
+    static size_t readLength(const char* in, size_t n, size_t& ip){
+        size_t length = 0;
+        uint8_t byte;
+        do{
+            if( ip >= n ) throw runtime_error("Corrupt compressed block");
+            byte = static_cast<uint8_t>(in[ip++]);
+            length += byte;
+        } while( byte == 255 );
+        return length;
+    }
+
+    // Decompresses into out[0, rawBytes); throws on a block that does not decode to exactly
+    // rawBytes, so corrupt input never writes out of bounds
+    static void decompress(string_view src, char* out, size_t rawBytes){
+        const char* in = src.data();
+        size_t n = src.size();
+        size_t ip = 0, op = 0;
+        while( true ){
+            if( ip >= n ) throw runtime_error("Corrupt compressed block");
+            uint8_t token = static_cast<uint8_t>(in[ip++]);
+            size_t literalCount = token >> 4;
+            if( literalCount == 15 ){
+                literalCount += readLength(in, n, ip);
+            }
+            if( literalCount > n - ip || literalCount > rawBytes - op ){
+                throw runtime_error("Corrupt compressed block");
+            }
+            // Short runs copy a fixed 16 bytes when both buffers have room, which is one move
+            // instead of a call; the bytes past the run are overwritten by what follows
+            if( literalCount <= 16 && n - ip >= 16 && rawBytes - op >= 16 ){
+                memcpy(out + op, in + ip, 16);
+            } else {
+                memcpy(out + op, in + ip, literalCount);
+            }
+            ip += literalCount;
+            op += literalCount;
+            if( ip == n ) break;
+            if( n - ip < 2 ) throw runtime_error("Corrupt compressed block");
+            size_t offset = static_cast<uint8_t>(in[ip]) | (static_cast<size_t>(static_cast<uint8_t>(in[ip + 1])) << 8);
+            ip += 2;
+            size_t length = token & 15;
+            if( length == 15 ){
+                length += readLength(in, n, ip);
+            }
+            length += minMatch;
+            if( offset == 0 || offset > op || length > rawBytes - op ){
+                throw runtime_error("Corrupt compressed block");
+            }
+            char* dst = out + op;
+            const char* ref = dst - offset;
+            op += length;
+            if( offset >= 16 && rawBytes - op >= 16 ){
+                // Chunks of 16 never overlap their source, and may run up to 15 bytes past the match
+                for( size_t copied = 0; copied < length; copied += 16 ){
+                    memcpy(dst + copied, ref + copied, 16);
+                }
+                continue;
+            }
+            // Copies of at most `offset` bytes never overlap, and repeat the pattern when the
+            // match is longer than its offset
+            while( length > 0 ){
+                size_t chunk = min(offset, length);
+                memcpy(dst, ref, chunk);
+                dst += chunk;
+                length -= chunk;
+            }
+        }
+        if( op != rawBytes ) throw runtime_error("Corrupt compressed block");
+    }
+};
+
+// What CompressedStorage keeps in its inner storage: small values as they are, large ones as
+// their SpillCodec bytes compressed with LzCodec
+template<typename V>
+struct CompressedValue{
+    struct Packed{
+        string bytes;
+        size_t rawBytes;
+    };
+
+    variant<V, Packed> stored;
+};
+
+// Totals over every value added, plus the current size of the hot set
+struct CompressionStats{
+    size_t values = 0;
+    size_t packedValues = 0;
+    size_t rawBytes = 0;
+    size_t storedBytes = 0;
+    size_t decompressions = 0;
+    size_t hotHits = 0;
+    size_t hotBytes = 0;
+
+    double compressionRatio() const{
+        return storedBytes ? static_cast<double>(rawBytes) / storedBytes : 1;
+    }
+};
+
+// Decorator that compresses values of at least `threshold` encoded bytes before handing them
+// to any IStorage, e.g. HashMapStorage or TTLHashMapStorage (expiry and TTLs pass through).
+// Values that do not shrink by an eighth are kept as they are. A lookup of a packed value
+// decompresses it; with hotEntries > 0 the decoded values of the most recently read packed
+// keys are kept in an LRU hot set, so the hottest keys skip decompression.
+// find() may return a buffer owned by the storage, valid until the next call on it.
+template<typename T, typename V>
+class CompressedStorage : public IStorage<T, V>{
+private:
+    using Stored = CompressedValue<V>;
+    using HotList = list<pair<T, V>>;
+
+    unique_ptr<IStorage<T, Stored>> inner;
+    size_t threshold;
+    size_t hotEntries;
+    HotList hotList;
+    unordered_map<T, typename HotList::iterator, KeyHash<T>, KeyEqual<T>> hotIndex;
+    V decoded{};
+    string scratch;
+    CompressionStats counters;
+
+    static size_t bytesOf(const V& val){
+        return SpillCodec<V>::size(val);
+    }
+
+    Stored pack(const V& val){
+        size_t raw = bytesOf(val);
+        counters.values++;
+        counters.rawBytes += raw;
+        if( raw >= threshold ){
+            const char* bytes;
+            if constexpr( same_as<V, string> ){
+                bytes = val.data();
+            } else {
+                scratch.resize(raw);
+                SpillCodec<V>::write(val, scratch.data());
+                bytes = scratch.data();
+            }
+            string packed;
+            LzCodec::compress(string_view(bytes, raw), packed);
+            if( packed.size() <= raw - raw / 8 ){
+                packed.shrink_to_fit();
+                counters.packedValues++;
+                counters.storedBytes += packed.size();
+                return Stored{typename Stored::Packed{move(packed), raw}};
+            }
+        }
+        counters.storedBytes += raw;
+        return Stored{val};
+    }
+
+    void unpack(const typename Stored::Packed& packed, V& out){
+        counters.decompressions++;
+        if constexpr( same_as<V, string> ){
+            out.resize(packed.rawBytes);
+            LzCodec::decompress(packed.bytes, out.data(), packed.rawBytes);
+        } else {
+            scratch.resize(packed.rawBytes);
+            LzCodec::decompress(packed.bytes, scratch.data(), packed.rawBytes);
+            out = SpillCodec<V>::read(scratch.data(), packed.rawBytes);
+        }
+    }
+
+    template<typename Key>
+    void forgetHot(const Key& key){
+        auto it = hotIndex.find(key);
+        if( it != hotIndex.end() ){
+            counters.hotBytes -= bytesOf(it->second->second);
+            hotList.erase(it->second);
+            hotIndex.erase(it);
+        }
+    }
+
+    // Key is T or HashedKey<T>. The inner lookup comes first, so expiry and the inner
+    // storage's own bookkeeping behave as without compression.
+    template<typename Key>
+    V* findDecoded(const Key& key){
+        Stored* entry = inner->find(key);
+        if( !entry ){
+            forgetHot(key);
+            return nullptr;
+        }
+        if( V* plain = get_if<V>(&entry->stored) ){
+            return plain;
+        }
+        const auto& packed = std::get<typename Stored::Packed>(entry->stored);
+        if( hotEntries == 0 ){
+            unpack(packed, decoded);
+            return &decoded;
+        }
+        auto it = hotIndex.find(key);
+        if( it != hotIndex.end() ){
+            counters.hotHits++;
+            hotList.splice(hotList.begin(), hotList, it->second);
+            return &it->second->second;
+        }
+        hotList.emplace_front(ownedKey(key), V{});
+        unpack(packed, hotList.front().second);
+        counters.hotBytes += packed.rawBytes;
+        hotIndex.emplace(hotList.front().first, hotList.begin());
+        if( hotList.size() > hotEntries ){
+            forgetHot(hotList.back().first);
+        }
+        return &hotList.front().second;
+    }
+
+public:
+    using IStorage<T, V>::add;
+
+    CompressedStorage(unique_ptr<IStorage<T, Stored>> _inner, size_t _threshold = 1024, size_t _hotEntries = 0)
+        : inner(move(_inner)), threshold(_threshold), hotEntries(_hotEntries){
+        hotIndex.reserve(hotEntries + 1);
+    }
+
+    void add(const T& key, const V& val) override{
+        forgetHot(key);
+        inner->add(key, pack(val));
+    }
+
+    void add(const T& key, const V& val, milliseconds ttl) override{
+        forgetHot(key);
+        inner->add(key, pack(val), ttl);
+    }
+
+    V get(const T& key) override{
+        V* val = find(key);
+        if( !val ){
+            throw runtime_error("Key not found in Compressed Cache");
+        }
+        return *val;
+    }
+
+    V* find(const T& key) override{
+        return findDecoded(key);
+    }
+
+    V* find(const HashedKey<T>& key) override{
+        return findDecoded(key);
+    }
+
+    void remove(const T& key) override{
+        forgetHot(key);
+        inner->remove(key);
+    }
+
+    bool exists(const T& key) override{
+        return inner->exists(key);
+    }
+
+    size_t size() const override{
+        return inner->size();
+    }
+
+    void setExpirationListener(function<void(const T&)> listener) override{
+        inner->setExpirationListener([this, listener = move(listener)](const T& key){
+            forgetHot(key);
+            if( listener ) listener(key);
+        });
+    }
+
+    void prefetch(const T& key) const override{
+        inner->prefetch(key);
+    }
+
+    void prefetch(const HashedKey<T>& key) const override{
+        inner->prefetch(key);
+    }
+
+    void reserve(size_t entries) override{
+        inner->reserve(entries);
+    }
+
+    CompressionStats stats() const{
+        return counters;
+    }
+};
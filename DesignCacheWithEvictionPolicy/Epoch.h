@@ -0,0 +1,155 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Most threads that may use an epoch domain at the same time
+constexpr size_t maxEpochThreads = 256;
+
+// Hands out small dense thread indexes, reused after a thread exits, so per-thread state can
+// live in plain arrays indexed by them instead of in shared maps
+class EpochThreadRegistry{
+private:
+    inline static mutex lock;
+    inline static vector<size_t> freeIndexes;
+    inline static atomic<size_t> highWater{0};
+
+    struct Handle{
+        size_t index;
+
+        Handle(){
+            lock_guard<mutex> guard(lock);
+            if( !freeIndexes.empty() ){
+                index = freeIndexes.back();
+                freeIndexes.pop_back();
+            } else if( highWater.load(memory_order_relaxed) < maxEpochThreads ){
+                index = highWater.load(memory_order_relaxed);
+                highWater.store(index + 1, memory_order_release);
+            } else {
+                throw runtime_error("Too many threads for the epoch domain");
+            }
+        }
+
+        ~Handle(){
+            lock_guard<mutex> guard(lock);
+            freeIndexes.push_back(index);
+        }
+    };
+
+public:
+    static size_t index(){
+        thread_local Handle handle;
+        return handle.index;
+    }
+
+    // Every index handed out so far is below this bound
+    static size_t count(){
+        return highWater.load(memory_order_acquire);
+    }
+};
+
+// Epoch-based reclamation. Readers pin the current epoch while they hold pointers into a
+// shared structure; writers unlink objects, retire them with the epoch they were unlinked
+// in, and free them once the epoch has advanced twice since. The epoch only advances when
+// every pinned thread has seen the current one, so no reader can still hold a freed object.
+// Pinning writes only the calling thread's own slot.
+class EpochDomain{
+private:
+    static constexpr uint64_t idle = 0;
+
+    struct alignas(64) Slot{
+        atomic<uint64_t> epoch{idle};
+        size_t depth = 0;   // nested pins of the owning thread
+    };
+
+    atomic<uint64_t> global{1};
+    unique_ptr<Slot[]> slots = make_unique<Slot[]>(maxEpochThreads);
+
+public:
+    // Keeps the calling thread pinned for its lifetime; guards may nest
+    class Guard{
+    private:
+        Slot* slot;
+
+    public:
+        Guard(EpochDomain& domain) : slot(&domain.slots[EpochThreadRegistry::index()]){
+            if( slot->depth++ == 0 ){
+                // Sequentially consistent, so loads after the pin cannot be reordered before it
+                slot->epoch.store(domain.global.load(memory_order_seq_cst), memory_order_seq_cst);
+            }
+        }
+
+        ~Guard(){
+            if( --slot->depth == 0 ){
+                slot->epoch.store(idle, memory_order_release);
+            }
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    Guard pin(){
+        return Guard(*this);
+    }
+
+    uint64_t current() const{
+        return global.load(memory_order_seq_cst);
+    }
+
+    // Advances the epoch if every pinned thread is in the current one; returns the epoch
+    uint64_t tryAdvance(){
+        uint64_t epoch = global.load(memory_order_seq_cst);
+        for( size_t i = 0, threads = EpochThreadRegistry::count(); i < threads; i++ ){
+            uint64_t pinned = slots[i].epoch.load(memory_order_seq_cst);
+            if( pinned != idle && pinned != epoch ){
+                return epoch;
+            }
+        }
+        global.compare_exchange_strong(epoch, epoch + 1, memory_order_seq_cst);
+        return global.load(memory_order_seq_cst);
+    }
+
+    // Objects retired in `retiredIn` are unreachable by every reader once this holds
+    static bool reclaimable(uint64_t retiredIn, uint64_t epoch){
+        return retiredIn + 2 <= epoch;
+    }
+};
+
+// Objects waiting for reclamation, in retirement order. Not thread-safe: its owner keeps it
+// under the same lock as the writes that retire into it.
+template<typename Node>
+class RetireList{
+private:
+    deque<pair<uint64_t, Node*>> retired;
+
+public:
+    RetireList() = default;
+    RetireList(const RetireList&) = delete;
+    RetireList& operator=(const RetireList&) = delete;
+
+    ~RetireList(){
+        for( auto& [epoch, node] : retired ){
+            delete node;
+        }
+    }
+
+    void retire(Node* node, uint64_t epoch){
+        retired.emplace_back(epoch, node);
+    }
+
+    // Frees every object that no reader can reach at `epoch`
+    void reclaim(uint64_t epoch){
+        while( !retired.empty() && EpochDomain::reclaimable(retired.front().first, epoch) ){
+            delete retired.front().second;
+            retired.pop_front();
+        }
+    }
+
+    size_t size() const{
+        return retired.size();
+    }
+};
@@ -0,0 +1,918 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "HashedKey.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+template<typename T>
+class IEvictionPolicy{
+  public:
+    virtual void keyAccessed(const T& key){};
+    // A hit looked up by view with the caller's hash; policies without a transparent index
+    // build a T
+    virtual void keyAccessed(const HashedKey<T>& key){
+        keyAccessed(T(key.key));
+    }
+    // Called by Cache::put for a key that is not resident, before any eviction it causes.
+    // Policies with ghost lists use it to adapt before choosing a victim.
+    virtual void keyMissed(const T& key){};
+    // Called when a key leaves the cache for any reason other than evict()
+    virtual void keyRemoved(const T& key){};
+    virtual T evict() = 0;
+    // True if keyAccessed for a key the policy already tracks may run concurrently with
+    // other such calls, so a thread-safe cache can serve hits under a shared lock
+    virtual bool concurrentHits() const{
+        return false;
+    }
+    // Hint that keyAccessed(key) follows soon, so batched lookups can overlap their memory misses
+    virtual void prefetch(const T& key) const{}
+    // Visits every resident key from the next victim to the most protected one, with a small
+    // frequency or segment hint that restore() understands (0 if the policy has none)
+    virtual void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const{
+        throw logic_error("This eviction policy does not support snapshots");
+    }
+    // Rebuilds the state of an empty policy from forEachInEvictionOrder output
+    virtual void restore(span<const T> keys, span<const uint8_t> frequencies){
+        for( const T& key : keys ){
+            keyAccessed(key);
+        }
+    }
+    virtual ~IEvictionPolicy() = default;
+};
+
+
+template<typename T, typename Alloc = allocator<T>>
+class LRUEvictionPolicy : public IEvictionPolicy<T>{
+private:
+    using KeyList = list<T, typename allocator_traits<Alloc>::template rebind_alloc<T>>;
+    using KeyMapAlloc = typename allocator_traits<Alloc>::template rebind_alloc<pair<const T, typename KeyList::iterator>>;
+
+    KeyList keyList;
+    unordered_map<T, typename KeyList::iterator, KeyHash<T>, KeyEqual<T>, KeyMapAlloc> keyMap;
+
+    // Key is T or HashedKey<T>; only a new key is copied into a T
+    template<typename Key>
+    void access(const Key& key){
+        auto it = keyMap.find(key);
+        if( it != keyMap.end() ){
+            keyList.splice(keyList.begin(), keyList, it->second);
+            return;
+        }
+        keyList.push_front(ownedKey(key));
+        keyMap.emplace(keyList.front(), keyList.begin());
+    }
+    
+public:
+    LRUEvictionPolicy(const Alloc& alloc = Alloc()) : keyList(alloc), keyMap(0, KeyHash<T>(), KeyEqual<T>(), alloc){}
+
+    // Sizes the key map up front so it never rehashes while the cache stays within capacity
+    LRUEvictionPolicy(size_t capacity, const Alloc& alloc = Alloc()) : LRUEvictionPolicy(alloc){
+        keyMap.reserve(capacity + 1);
+    }
+
+    void keyAccessed(const T& key) override{
+        access(key);
+    }
+
+    void keyAccessed(const HashedKey<T>& key) override{
+        access(key);
+    }
+    
+    T evict() override {
+        if( keyList.empty() ){
+            throw runtime_error("No item to evict");
+        }
+        T lastKey = keyList.back();
+        keyList.pop_back();
+        keyMap.erase(lastKey);
+        
+        return lastKey;
+    }
+
+    void keyRemoved(const T& key) override{
+        auto it = keyMap.find(key);
+        if( it != keyMap.end() ){
+            keyList.erase(it->second);
+            keyMap.erase(it);
+        }
+    }
+
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const override{
+        for( auto it = keyList.rbegin(); it != keyList.rend(); ++it ){
+            visit(*it, 0);
+        }
+    }
+
+    void restore(span<const T> keys, span<const uint8_t> frequencies) override{
+        keyMap.reserve(keyMap.size() + keys.size());
+        for( const T& key : keys ){
+            keyList.push_front(key);
+            keyMap.emplace(key, keyList.begin());
+        }
+    }
+};
+
+// Count-min sketch of 4-bit counters, 16 per 64-bit word, used to estimate access frequency.
+// Once the number of increments reaches the sample size every counter is halved, so stale
+// popularity ages out.
+template<typename T>
+class FrequencySketch{
+private:
+    static constexpr int DEPTH = 4;
+    vector<uint64_t> table;
+    uint64_t mask;
+    size_t sampleSize;
+    size_t additions = 0;
+    hash<T> hasher;
+
+    static uint64_t mix(uint64_t h, uint64_t seed){
+        h = (h + seed) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 32;
+        h *= 0xD6E8FEB86659FD93ULL;
+        return h ^ (h >> 32);
+    }
+
+    // Row i uses nibbles [4i, 4i + 4) of its word and picks one of them with two hash bits
+    pair<size_t, int> counterAt(uint64_t h, int row) const{
+        uint64_t rowHash = mix(h, row + 1);
+        return { rowHash & mask, (row * 4 + static_cast<int>(rowHash >> 62)) * 4 };
+    }
+
+    void halve(){
+        for( uint64_t& word : table ){
+            word = (word >> 1) & 0x7777777777777777ULL;
+        }
+        additions /= 2;
+    }
+
+public:
+    FrequencySketch(size_t capacity){
+        size_t width = 16;
+        while( width < capacity ){
+            width <<= 1;
+        }
+        table.assign(width, 0);
+        mask = width - 1;
+        sampleSize = 10 * max<size_t>(capacity, 1);
+    }
+
+    void increment(const T& key){
+        incrementHash(hasher(key));
+    }
+
+    void increment(const HashedKey<T>& key){
+        incrementHash(key.hash);
+    }
+
+    // Counts a key by its std::hash
+    void incrementHash(uint64_t h){
+        bool added = false;
+        for( int row = 0; row < DEPTH; row++ ){
+            auto [index, shift] = counterAt(h, row);
+            if( ((table[index] >> shift) & 0xF) != 0xF ){
+                table[index] += uint64_t(1) << shift;
+                added = true;
+            }
+        }
+        if( added && ++additions >= sampleSize ){
+            halve();
+        }
+    }
+
+    // Raises the key's counters to at least `count`, without counting towards the next halving
+    void raise(const T& key, int count){
+        uint64_t h = hasher(key);
+        uint64_t target = static_cast<uint64_t>(min(count, 0xF));
+        for( int row = 0; row < DEPTH; row++ ){
+            auto [index, shift] = counterAt(h, row);
+            uint64_t current = (table[index] >> shift) & 0xF;
+            if( current < target ){
+                table[index] += (target - current) << shift;
+            }
+        }
+    }
+
+    int frequency(const T& key) const{
+        uint64_t h = hasher(key);
+        int estimate = 0xF;
+        for( int row = 0; row < DEPTH; row++ ){
+            auto [index, shift] = counterAt(h, row);
+            estimate = min(estimate, static_cast<int>((table[index] >> shift) & 0xF));
+        }
+        return estimate;
+    }
+};
+
+// W-TinyLFU: new keys enter a small LRU window (1% of capacity). When the window overflows,
+// its LRU key only enters the main segmented LRU if the sketch says it is used more often
+// than the main cache's own victim, so a one-off scan cannot flush the hot set.
+template<typename T>
+class WTinyLFUEvictionPolicy : public IEvictionPolicy<T>{
+private:
+    enum class Segment{ Window, Probation, Protected };
+
+    struct Position{
+        Segment segment;
+        typename list<T>::iterator it;
+    };
+
+    list<T> window;
+    list<T> probation;
+    list<T> protectedList;
+    unordered_map<T, Position, KeyHash<T>, KeyEqual<T>> keyMap;
+    FrequencySketch<T> sketch;
+    size_t windowCapacity;
+    size_t protectedCapacity;
+
+    list<T>& segmentList(Segment segment){
+        switch( segment ){
+            case Segment::Window: return window;
+            case Segment::Probation: return probation;
+            default: return protectedList;
+        }
+    }
+
+    void moveTo(Position& position, Segment segment){
+        list<T>& target = segmentList(segment);
+        target.splice(target.begin(), segmentList(position.segment), position.it);
+        position.segment = segment;
+    }
+
+    // Removes and returns the tail of the given segment
+    T evictFrom(list<T>& segment){
+        T victim = segment.back();
+        segment.pop_back();
+        keyMap.erase(victim);
+        return victim;
+    }
+
+    list<T>& mainVictimSegment(){
+        return probation.empty() ? protectedList : probation;
+    }
+
+    // Key is T or HashedKey<T>; only a new key is copied into a T
+    template<typename Key>
+    void access(const Key& key){
+        sketch.increment(key);
+        auto found = keyMap.find(key);
+        if( found == keyMap.end() ){
+            window.push_front(ownedKey(key));
+            keyMap[window.front()] = { Segment::Window, window.begin() };
+            // While the cache is still filling up, window overflow moves to main without a contest
+            if( window.size() > windowCapacity ){
+                moveTo(keyMap[window.back()], Segment::Probation);
+            }
+            return;
+        }
+        Position& position = found->second;
+        if( position.segment == Segment::Probation ){
+            moveTo(position, Segment::Protected);
+            if( protectedList.size() > protectedCapacity ){
+                moveTo(keyMap[protectedList.back()], Segment::Probation);
+            }
+        } else {
+            moveTo(position, position.segment);
+        }
+    }
+
+public:
+    WTinyLFUEvictionPolicy(size_t capacity) : sketch(capacity){
+        windowCapacity = max<size_t>(1, capacity / 100);
+        size_t mainCapacity = capacity > windowCapacity ? capacity - windowCapacity : 1;
+        protectedCapacity = max<size_t>(1, mainCapacity * 8 / 10);
+    }
+
+    void keyAccessed(const T& key) override{
+        access(key);
+    }
+
+    void keyAccessed(const HashedKey<T>& key) override{
+        access(key);
+    }
+
+    T evict() override{
+        if( keyMap.empty() ){
+            throw runtime_error("No item to evict");
+        }
+        if( probation.empty() && protectedList.empty() ){
+            return evictFrom(window);
+        }
+        if( window.size() < windowCapacity ){
+            return evictFrom(mainVictimSegment());
+        }
+        // The incoming key will push the window's LRU key out, so it competes with the
+        // main cache's victim for admission
+        T candidate = window.back();
+        list<T>& victimSegment = mainVictimSegment();
+        if( sketch.frequency(candidate) > sketch.frequency(victimSegment.back()) ){
+            moveTo(keyMap[candidate], Segment::Probation);
+            return evictFrom(victimSegment);
+        }
+        return evictFrom(window);
+    }
+
+    void keyRemoved(const T& key) override{
+        auto found = keyMap.find(key);
+        if( found != keyMap.end() ){
+            segmentList(found->second.segment).erase(found->second.it);
+            keyMap.erase(found);
+        }
+    }
+
+    // Probation, then window, then protected, each from its LRU end; the hint is the
+    // sketch's frequency estimate
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const override{
+        for( const list<T>* segment : {&probation, &window, &protectedList} ){
+            for( auto it = segment->rbegin(); it != segment->rend(); ++it ){
+                visit(*it, static_cast<uint8_t>(sketch.frequency(*it)));
+            }
+        }
+    }
+
+    // The hottest keys refill protected, the next ones the window and the rest probation
+    void restore(span<const T> keys, span<const uint8_t> frequencies) override{
+        size_t protectedCount = min(protectedCapacity, keys.size());
+        size_t windowCount = min(windowCapacity, keys.size() - protectedCount);
+        size_t probationCount = keys.size() - protectedCount - windowCount;
+        keyMap.reserve(keyMap.size() + keys.size());
+        for( size_t i = 0; i < keys.size(); i++ ){
+            Segment segment = i < probationCount ? Segment::Probation : i < probationCount + windowCount ? Segment::Window : Segment::Protected;
+            list<T>& target = segmentList(segment);
+            target.push_front(keys[i]);
+            keyMap[keys[i]] = { segment, target.begin() };
+            sketch.raise(keys[i], i < frequencies.size() ? frequencies[i] : 0);
+        }
+    }
+};
+
+// CLOCK: keys sit in a contiguous array with one reference bit each. A hit only sets the bit
+// (a relaxed atomic store, skipped if already set), so hits never move list nodes and can run
+// concurrently. evict() sweeps the hand, clearing bits, until it finds an unreferenced key.
+template<typename T>
+class ClockEvictionPolicy : public IEvictionPolicy<T>{
+private:
+    vector<T> keys;
+    vector<uint8_t> referenced;  // accessed through atomic_ref so concurrent hits are race-free
+    vector<uint8_t> occupied;
+    vector<size_t> freeSlots;
+    unordered_map<T, size_t, KeyHash<T>, KeyEqual<T>> index;
+    size_t hand = 0;
+
+    // Key is T or HashedKey<T>; only a new key is copied into a T
+    template<typename Key>
+    void access(const Key& key){
+        auto it = index.find(key);
+        if( it != index.end() ){
+            atomic_ref<uint8_t> bit(referenced[it->second]);
+            if( !bit.load(memory_order_relaxed) ){
+                bit.store(1, memory_order_relaxed);
+            }
+            return;
+        }
+        size_t slot;
+        if( !freeSlots.empty() ){
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+            keys[slot] = ownedKey(key);
+        } else {
+            slot = keys.size();
+            keys.push_back(ownedKey(key));
+            referenced.push_back(0);
+            occupied.push_back(0);
+        }
+        referenced[slot] = 0;
+        occupied[slot] = 1;
+        index.emplace(keys[slot], slot);
+    }
+
+public:
+    ClockEvictionPolicy(size_t capacity = 0){
+        keys.reserve(capacity);
+        referenced.reserve(capacity);
+        occupied.reserve(capacity);
+        index.reserve(capacity);
+    }
+
+    void keyAccessed(const T& key) override{
+        access(key);
+    }
+
+    void keyAccessed(const HashedKey<T>& key) override{
+        access(key);
+    }
+
+    T evict() override{
+        if( index.empty() ){
+            throw runtime_error("No item to evict");
+        }
+        while( true ){
+            size_t slot = hand;
+            hand = (hand + 1) % keys.size();
+            if( !occupied[slot] ){
+                continue;
+            }
+            if( referenced[slot] ){
+                referenced[slot] = 0;
+                continue;
+            }
+            occupied[slot] = 0;
+            freeSlots.push_back(slot);
+            index.erase(keys[slot]);
+            return keys[slot];
+        }
+    }
+
+    void keyRemoved(const T& key) override{
+        auto it = index.find(key);
+        if( it != index.end() ){
+            occupied[it->second] = 0;
+            referenced[it->second] = 0;
+            freeSlots.push_back(it->second);
+            index.erase(it);
+        }
+    }
+
+    bool concurrentHits() const override{
+        return true;
+    }
+
+    // Occupied slots in sweep order starting at the hand; the hint is the reference bit
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const override{
+        for( size_t i = 0; i < keys.size(); i++ ){
+            size_t slot = (hand + i) % keys.size();
+            if( occupied[slot] ){
+                visit(keys[slot], referenced[slot]);
+            }
+        }
+    }
+
+    void restore(span<const T> restored, span<const uint8_t> frequencies) override{
+        if( !index.empty() ){
+            IEvictionPolicy<T>::restore(restored, frequencies);
+            return;
+        }
+        keys.assign(restored.begin(), restored.end());
+        referenced.assign(restored.size(), 0);
+        occupied.assign(restored.size(), 1);
+        freeSlots.clear();
+        index.reserve(restored.size());
+        for( size_t slot = 0; slot < restored.size(); slot++ ){
+            referenced[slot] = slot < frequencies.size() && frequencies[slot] ? 1 : 0;
+            index.emplace(restored[slot], slot);
+        }
+        hand = 0;
+    }
+};
+
+// ARC (Adaptive Replacement Cache). Resident keys are split between T1 (seen once recently)
+// and T2 (seen at least twice); B1 and B2 remember keys recently evicted from each, without
+// values. A miss that hits a ghost list shifts the target size p of T1 towards the side that
+// would have kept the key, so the split adapts between recency and frequency.
+template<typename T>
+class ARCEvictionPolicy : public IEvictionPolicy<T>{
+private:
+    enum ListId{ T1, T2, B1, B2 };
+
+    struct Position{
+        ListId id;
+        typename list<T>::iterator it;
+    };
+
+    list<T> lists[4];
+    unordered_map<T, Position, KeyHash<T>, KeyEqual<T>> keyMap;
+    size_t capacity;
+    size_t p = 0;
+    bool incomingFromB2 = false;
+
+    void moveToFront(Position& position, ListId id){
+        lists[id].splice(lists[id].begin(), lists[position.id], position.it);
+        position.id = id;
+    }
+
+    void dropLRU(ListId id){
+        keyMap.erase(lists[id].back());
+        lists[id].pop_back();
+    }
+
+    // Keeps |T1| + |B1| <= c and |B1| + |B2| <= c, which bounds the ghosts to c keys
+    void trimGhosts(){
+        while( lists[T1].size() + lists[B1].size() > capacity && !lists[B1].empty() ){
+            dropLRU(B1);
+        }
+        while( lists[B1].size() + lists[B2].size() > capacity ){
+            dropLRU(lists[B2].empty() ? B1 : B2);
+        }
+    }
+
+    // Key is T or HashedKey<T>; only a new key is copied into a T
+    template<typename Key>
+    void access(const Key& key){
+        auto found = keyMap.find(key);
+        if( found == keyMap.end() ){
+            lists[T1].push_front(ownedKey(key));
+            keyMap[lists[T1].front()] = { T1, lists[T1].begin() };
+        } else {
+            // Resident hits and ghost hits both land in T2
+            moveToFront(found->second, T2);
+        }
+        incomingFromB2 = false;
+        trimGhosts();
+    }
+
+public:
+    ARCEvictionPolicy(size_t _capacity) : capacity(max<size_t>(_capacity, 1)){}
+
+    void keyMissed(const T& key) override{
+        incomingFromB2 = false;
+        auto found = keyMap.find(key);
+        if( found == keyMap.end() ){
+            return;
+        }
+        size_t b1 = lists[B1].size(), b2 = lists[B2].size();
+        if( found->second.id == B1 ){
+            p = min(capacity, p + max<size_t>(1, b2 / b1));
+        } else if( found->second.id == B2 ){
+            p -= min(p, max<size_t>(1, b1 / b2));
+            incomingFromB2 = true;
+        }
+    }
+
+    void keyAccessed(const T& key) override{
+        access(key);
+    }
+
+    void keyAccessed(const HashedKey<T>& key) override{
+        access(key);
+    }
+
+    T evict() override{
+        if( lists[T1].empty() && lists[T2].empty() ){
+            throw runtime_error("No item to evict");
+        }
+        bool fromT1 = !lists[T1].empty() && (lists[T1].size() > p || (incomingFromB2 && lists[T1].size() == p) || lists[T2].empty());
+        ListId source = fromT1 ? T1 : T2;
+        T victim = lists[source].back();
+        moveToFront(keyMap[victim], fromT1 ? B1 : B2);
+        return victim;
+    }
+
+    void keyRemoved(const T& key) override{
+        auto found = keyMap.find(key);
+        if( found != keyMap.end() && (found->second.id == T1 || found->second.id == T2) ){
+            lists[found->second.id].erase(found->second.it);
+            keyMap.erase(found);
+        }
+    }
+
+    size_t targetRecencySize() const{
+        return p;
+    }
+
+    // T1 then T2, each from its LRU end; the hint is 1 for keys in T2. The ghost lists and
+    // the target size p are not kept, so a restored cache adapts again from p = 0.
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const override{
+        for( ListId id : {T1, T2} ){
+            for( auto it = lists[id].rbegin(); it != lists[id].rend(); ++it ){
+                visit(*it, id == T2);
+            }
+        }
+    }
+
+    void restore(span<const T> keys, span<const uint8_t> frequencies) override{
+        keyMap.reserve(keyMap.size() + keys.size());
+        for( size_t i = 0; i < keys.size(); i++ ){
+            ListId id = i < frequencies.size() && frequencies[i] ? T2 : T1;
+            lists[id].push_front(keys[i]);
+            keyMap[keys[i]] = { id, lists[id].begin() };
+        }
+    }
+};
+
+// 2Q (full version). New keys enter A1in, a FIFO holding a quarter of the capacity; keys
+// pushed out of A1in are remembered in the A1out ghost queue (keys only, half the capacity).
+// Only a key requested again while in A1out is promoted into Am, the main LRU, so a one-off
+// scan passes through A1in without displacing Am.
+template<typename T>
+class TwoQueueEvictionPolicy : public IEvictionPolicy<T>{
+private:
+    enum ListId{ A1In, A1Out, Am };
+
+    struct Position{
+        ListId id;
+        typename list<T>::iterator it;
+    };
+
+    list<T> lists[3];
+    unordered_map<T, Position, KeyHash<T>, KeyEqual<T>> keyMap;
+    size_t inCapacity;
+    size_t outCapacity;
+
+    void moveToFront(Position& position, ListId id){
+        lists[id].splice(lists[id].begin(), lists[position.id], position.it);
+        position.id = id;
+    }
+
+    // Key is T or HashedKey<T>; only a new key is copied into a T
+    template<typename Key>
+    void access(const Key& key){
+        auto found = keyMap.find(key);
+        if( found == keyMap.end() ){
+            lists[A1In].push_front(ownedKey(key));
+            keyMap[lists[A1In].front()] = { A1In, lists[A1In].begin() };
+            return;
+        }
+        // A hit in A1in is deliberately ignored: correlated re-references do not prove popularity
+        if( found->second.id != A1In ){
+            moveToFront(found->second, Am);
+        }
+    }
+
+public:
+    TwoQueueEvictionPolicy(size_t capacity) : inCapacity(max<size_t>(1, capacity / 4)), outCapacity(max<size_t>(1, capacity / 2)){}
+
+    void keyAccessed(const T& key) override{
+        access(key);
+    }
+
+    void keyAccessed(const HashedKey<T>& key) override{
+        access(key);
+    }
+
+    T evict() override{
+        if( lists[A1In].empty() && lists[Am].empty() ){
+            throw runtime_error("No item to evict");
+        }
+        if( lists[A1In].size() > inCapacity || lists[Am].empty() ){
+            T victim = lists[A1In].back();
+            moveToFront(keyMap[victim], A1Out);
+            if( lists[A1Out].size() > outCapacity ){
+                keyMap.erase(lists[A1Out].back());
+                lists[A1Out].pop_back();
+            }
+            return victim;
+        }
+        T victim = lists[Am].back();
+        lists[Am].pop_back();
+        keyMap.erase(victim);
+        return victim;
+    }
+
+    void keyRemoved(const T& key) override{
+        auto found = keyMap.find(key);
+        if( found != keyMap.end() && found->second.id != A1Out ){
+            lists[found->second.id].erase(found->second.it);
+            keyMap.erase(found);
+        }
+    }
+    // A1in then Am, each from its LRU end; the hint is 1 for keys in Am. A1out is not kept.
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const override{
+        for( ListId id : {A1In, Am} ){
+            for( auto it = lists[id].rbegin(); it != lists[id].rend(); ++it ){
+                visit(*it, id == Am);
+            }
+        }
+    }
+
+    void restore(span<const T> keys, span<const uint8_t> frequencies) override{
+        keyMap.reserve(keyMap.size() + keys.size());
+        for( size_t i = 0; i < keys.size(); i++ ){
+            ListId id = i < frequencies.size() && frequencies[i] ? Am : A1In;
+            lists[id].push_front(keys[i]);
+            keyMap[keys[i]] = { id, lists[id].begin() };
+        }
+    }
+};
+
+
+// Hit ratio one AdaptiveEvictionPolicy candidate reached on the sampled keys
+struct AdaptivePolicyStats{
+    string name;
+    double hitRatio;
+    uint64_t sampledAccesses;
+    bool live;
+};
+
+// Runs several candidate policies side by side on miniature caches fed with a spatially
+// sampled subset of keys (SHARDS: a key is sampled iff its hash falls below a threshold, so
+// every access of a sampled key is seen), each sized at capacity * sampleRate. At the end of
+// every window of sampled accesses the hit ratios are decayed by half, and if another candidate
+// beats the live one by more than `margin` the live policy is rebuilt as that candidate from
+// the current eviction order. Sampling is raised so a miniature holds at least 64 keys.
+// Only accesses the cache reports reach the simulations, so get misses that are not followed
+// by a put are not counted. Candidates must support forEachInEvictionOrder.
+template<typename T>
+class AdaptiveEvictionPolicy : public IEvictionPolicy<T>{
+public:
+    using Factory = function<unique_ptr<IEvictionPolicy<T>>(size_t capacity)>;
+
+    struct Candidate{
+        string name;
+        Factory make;
+    };
+
+private:
+    static constexpr uint64_t hashRange = uint64_t(1) << 24;
+    static constexpr size_t minShadowCapacity = 64;
+
+    struct Shadow{
+        unique_ptr<IEvictionPolicy<T>> policy;
+        unordered_set<T> resident;
+        double hits = 0;
+        double accesses = 0;
+        uint64_t sampledAccesses = 0;
+
+        double hitRatio() const{
+            return accesses > 0 ? hits / accesses : 0;
+        }
+    };
+
+    size_t capacity;
+    vector<Candidate> candidates;
+    vector<Shadow> shadows;
+    unique_ptr<IEvictionPolicy<T>> livePolicy;
+    size_t live = 0;
+    size_t shadowCapacity;
+    uint64_t threshold;
+    size_t window;
+    size_t windowAccesses = 0;
+    double margin;
+    size_t switches = 0;
+    hash<T> hasher;
+
+    // One SplitMix64 step: std::hash is the identity for integers, and without the added
+    // constant key 0, often the hottest key of a trace, would always be sampled
+    bool sampled(const T& key) const{
+        return sampledHash(hasher(key));
+    }
+
+    bool sampledHash(size_t hash) const{
+        uint64_t h = static_cast<uint64_t>(hash) + 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        return (h >> 40) < threshold;
+    }
+
+    void simulate(Shadow& shadow, const T& key){
+        shadow.accesses++;
+        shadow.sampledAccesses++;
+        if( shadow.resident.count(key) ){
+            shadow.hits++;
+        } else {
+            shadow.policy->keyMissed(key);
+            if( shadow.resident.size() >= shadowCapacity ){
+                shadow.resident.erase(shadow.policy->evict());
+            }
+            shadow.resident.insert(key);
+        }
+        shadow.policy->keyAccessed(key);
+    }
+
+    // A sampled access replays on every miniature
+    void observe(const T& key){
+        for( Shadow& shadow : shadows ){
+            simulate(shadow, key);
+        }
+        if( ++windowAccesses == window ){
+            endWindow();
+        }
+    }
+
+    void endWindow(){
+        windowAccesses = 0;
+        size_t best = live;
+        for( size_t i = 0; i < shadows.size(); i++ ){
+            if( shadows[i].hitRatio() > shadows[best].hitRatio() ){
+                best = i;
+            }
+        }
+        if( best != live && shadows[best].hitRatio() > shadows[live].hitRatio() + margin ){
+            switchTo(best);
+        }
+        for( Shadow& shadow : shadows ){
+            shadow.hits /= 2;
+            shadow.accesses /= 2;
+        }
+    }
+
+    // The new policy starts from the old one's eviction order; hints are policy specific, so
+    // they are not carried over
+    void switchTo(size_t index){
+        vector<T> keys;
+        livePolicy->forEachInEvictionOrder([&](const T& key, uint8_t){ keys.push_back(key); });
+        unique_ptr<IEvictionPolicy<T>> next = candidates[index].make(capacity);
+        next->restore(keys, vector<uint8_t>(keys.size()));
+        livePolicy = move(next);
+        live = index;
+        switches++;
+    }
+
+public:
+    // The first candidate starts live
+    AdaptiveEvictionPolicy(size_t _capacity, vector<Candidate> _candidates, double sampleRate = 0.01, size_t _window = 1000, double _margin = 0.01)
+        : capacity(_capacity), candidates(move(_candidates)), window(max<size_t>(_window, 1)), margin(_margin){
+        if( candidates.empty() ){
+            throw invalid_argument("Adaptive policy needs at least one candidate");
+        }
+        double rate = clamp(max(sampleRate, static_cast<double>(minShadowCapacity) / max<size_t>(capacity, 1)), 0.0, 1.0);
+        threshold = static_cast<uint64_t>(rate * hashRange);
+        shadowCapacity = max<size_t>(1, static_cast<size_t>(capacity * rate));
+        for( const Candidate& candidate : candidates ){
+            Shadow& shadow = shadows.emplace_back();
+            shadow.policy = candidate.make(shadowCapacity);
+            shadow.resident.reserve(shadowCapacity + 1);
+        }
+        livePolicy = candidates[0].make(capacity);
+    }
+
+    // LRU, W-TinyLFU, CLOCK, ARC and 2Q, starting with LRU
+    static vector<Candidate> standardCandidates(){
+        return {
+            {"lru", [](size_t c){ return make_unique<LRUEvictionPolicy<T>>(c); }},
+            {"tinylfu", [](size_t c){ return make_unique<WTinyLFUEvictionPolicy<T>>(c); }},
+            {"clock", [](size_t c){ return make_unique<ClockEvictionPolicy<T>>(c); }},
+            {"arc", [](size_t c){ return make_unique<ARCEvictionPolicy<T>>(c); }},
+            {"2q", [](size_t c){ return make_unique<TwoQueueEvictionPolicy<T>>(c); }},
+        };
+    }
+
+    void keyAccessed(const T& key) override{
+        livePolicy->keyAccessed(key);
+        if( sampled(key) ){
+            observe(key);
+        }
+    }
+
+    // Only a sampled key is copied into a T, for the miniatures
+    void keyAccessed(const HashedKey<T>& key) override{
+        livePolicy->keyAccessed(key);
+        if( sampledHash(key.hash) ){
+            observe(T(key.key));
+        }
+    }
+
+    void keyMissed(const T& key) override{
+        livePolicy->keyMissed(key);
+    }
+
+    // Expired and removed keys leave the miniatures too, so TTL-heavy workloads are simulated
+    void keyRemoved(const T& key) override{
+        livePolicy->keyRemoved(key);
+        if( !sampled(key) ) return;
+        for( Shadow& shadow : shadows ){
+            if( shadow.resident.erase(key) ){
+                shadow.policy->keyRemoved(key);
+            }
+        }
+    }
+
+    T evict() override{
+        return livePolicy->evict();
+    }
+
+    void prefetch(const T& key) const override{
+        livePolicy->prefetch(key);
+    }
+
+    // Snapshots carry the live policy's order and hints
+    void forEachInEvictionOrder(const function<void(const T&, uint8_t)>& visit) const override{
+        livePolicy->forEachInEvictionOrder(visit);
+    }
+
+    void restore(span<const T> keys, span<const uint8_t> frequencies) override{
+        livePolicy->restore(keys, frequencies);
+    }
+
+    const string& livePolicyName() const{
+        return candidates[live].name;
+    }
+
+    size_t switchCount() const{
+        return switches;
+    }
+
+    // Decayed hit ratios of every candidate on the sampled keys, in candidate order
+    vector<AdaptivePolicyStats> policyStats() const{
+        vector<AdaptivePolicyStats> stats;
+        for( size_t i = 0; i < shadows.size(); i++ ){
+            stats.push_back({candidates[i].name, shadows[i].hitRatio(), shadows[i].sampledAccesses, i == live});
+        }
+        return stats;
+    }
+};
+
+// Policy by name: lru, clock, tinylfu, arc, 2q or adaptive (over the standard candidates)
+template<typename T>
+unique_ptr<IEvictionPolicy<T>> makeEvictionPolicy(const string& name, size_t capacity){
+    if( name == "lru" ) return make_unique<LRUEvictionPolicy<T>>(capacity);
+    if( name == "clock" ) return make_unique<ClockEvictionPolicy<T>>(capacity);
+    if( name == "tinylfu" ) return make_unique<WTinyLFUEvictionPolicy<T>>(capacity);
+    if( name == "arc" ) return make_unique<ARCEvictionPolicy<T>>(capacity);
+    if( name == "2q" ) return make_unique<TwoQueueEvictionPolicy<T>>(capacity);
+    if( name == "adaptive" ) return make_unique<AdaptiveEvictionPolicy<T>>(capacity, AdaptiveEvictionPolicy<T>::standardCandidates());
+    throw invalid_argument("Unknown policy " + name);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+
+using namespace std;
+using namespace std::chrono;
+
+// The type a key can be looked up by without building a T: string keys by string_view (so
+// callers holding a view or a char buffer need no temporary string), other keys by reference
+template<typename T>
+struct KeyLookup{
+    using type = const T&;
+};
+
+template<>
+struct KeyLookup<string>{
+    using type = string_view;
+};
+
+template<typename T>
+using LookupKey = typename KeyLookup<T>::type;
+
+// A lookup key with its hash computed once, by the caller or on construction. Storages,
+// policies and shard selection that take it reuse the hash instead of rehashing the key.
+// The hash must be std::hash<T> of the key (for strings, equally std::hash<string_view>).
+// Only valid while the viewed key is.
+template<typename T>
+struct HashedKey{
+    LookupKey<T> key;
+    size_t hash;
+
+    HashedKey(LookupKey<T> _key) : key(_key), hash(std::hash<remove_cvref_t<LookupKey<T>>>()(_key)){}
+    HashedKey(LookupKey<T> _key, size_t _hash) : key(_key), hash(_hash){}
+};
+
+// Transparent hash and equality for maps keyed by T, so find() accepts a LookupKey or a
+// HashedKey; a HashedKey's hash is used as is
+template<typename T>
+struct KeyHash{
+    using is_transparent = void;
+
+    size_t operator()(LookupKey<T> key) const{
+        return hash<remove_cvref_t<LookupKey<T>>>()(key);
+    }
+
+    size_t operator()(const HashedKey<T>& key) const{
+        return key.hash;
+    }
+};
+
+template<typename T>
+struct KeyEqual{
+    using is_transparent = void;
+
+    bool operator()(LookupKey<T> a, LookupKey<T> b) const{
+        return a == b;
+    }
+
+    bool operator()(const HashedKey<T>& a, LookupKey<T> b) const{
+        return a.key == b;
+    }
+
+    bool operator()(LookupKey<T> a, const HashedKey<T>& b) const{
+        return a == b.key;
+    }
+};
+
+// The key as a T, for code paths that store it; a T passes through without a copy
+template<typename T>
+const T& ownedKey(const T& key){
+    return key;
+}
+
+template<typename T>
+T ownedKey(const HashedKey<T>& key){
+    return T(key.key);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Collects single-key loads arriving within a short window and hands them to the
+// backend as one loadAll call. A worker thread flushes a batch once the oldest request
+// has waited `window`, or as soon as maxBatch distinct keys are pending.
+// Keys missing from the loadAll result fail with "Key Not Found in the Backend".
+template<typename T, typename V>
+class BatchLoader{
+public:
+    using LoadAll = function<unordered_map<T, V>(const vector<T>&)>;
+    // Receives the loaded value, or nullptr and the error if the load failed
+    using Callback = function<void(const T&, const V*, exception_ptr)>;
+
+private:
+    LoadAll loadAll;
+    milliseconds window;
+    size_t maxBatch;
+
+    mutex lock;
+    condition_variable wakeup;
+    unordered_map<T, vector<Callback>> pending;
+    vector<T> pendingOrder;
+    steady_clock::time_point oldestRequest;
+    bool stopping = false;
+    size_t batchCount = 0;
+    thread worker;
+
+    void run(){
+        unique_lock<mutex> guard(lock);
+        while( true ){
+            wakeup.wait(guard, [&]{ return stopping || !pending.empty(); });
+            if( pending.empty() ){
+                return;
+            }
+            wakeup.wait_until(guard, oldestRequest + window, [&]{ return stopping || pendingOrder.size() >= maxBatch; });
+
+            unordered_map<T, vector<Callback>> batch;
+            vector<T> keys;
+            batch.swap(pending);
+            keys.swap(pendingOrder);
+            batchCount++;
+            guard.unlock();
+            deliver(keys, batch);
+            guard.lock();
+        }
+    }
+
+    void deliver(const vector<T>& keys, unordered_map<T, vector<Callback>>& batch){
+        unordered_map<T, V> loaded;
+        exception_ptr error;
+        try{
+            loaded = loadAll(keys);
+        } catch( ... ){
+            error = current_exception();
+        }
+        for( const T& key : keys ){
+            auto it = loaded.find(key);
+            exception_ptr keyError = error;
+            if( !keyError && it == loaded.end() ){
+                keyError = make_exception_ptr(runtime_error("Key Not Found in the Backend"));
+            }
+            for( Callback& done : batch[key] ){
+                done(key, keyError ? nullptr : &it->second, keyError);
+            }
+        }
+    }
+
+public:
+    BatchLoader(LoadAll _loadAll, milliseconds _window = milliseconds(2), size_t _maxBatch = 256) : loadAll(move(_loadAll)), window(_window), maxBatch(max<size_t>(_maxBatch, 1)){
+        worker = thread([this]{ run(); });
+    }
+
+    // Pending requests are flushed before the worker exits
+    ~BatchLoader(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        worker.join();
+    }
+
+    BatchLoader(const BatchLoader&) = delete;
+    BatchLoader& operator=(const BatchLoader&) = delete;
+
+    // Callbacks run on the worker thread
+    void submit(const T& key, Callback done){
+        {
+            lock_guard<mutex> guard(lock);
+            if( pending.empty() ){
+                oldestRequest = steady_clock::now();
+            }
+            auto [it, inserted] = pending.try_emplace(key);
+            if( inserted ){
+                pendingOrder.push_back(key);
+            }
+            it->second.push_back(move(done));
+        }
+        wakeup.notify_all();
+    }
+
+    future<V> load(const T& key){
+        auto result = make_shared<promise<V>>();
+        submit(key, [result](const T&, const V* val, exception_ptr error){
+            if( val ){
+                result->set_value(*val);
+            } else {
+                result->set_exception(error);
+            }
+        });
+        return result->get_future();
+    }
+
+    // Lets a BatchLoader be passed as the loader of ShardedCache::getOrLoad
+    V operator()(const T& key){
+        return load(key).get();
+    }
+
+    size_t batches(){
+        lock_guard<mutex> guard(lock);
+        return batchCount;
+    }
+};
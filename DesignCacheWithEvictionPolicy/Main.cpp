@@ -1,165 +1,662 @@
-#include <bits/stdc++.h>
-#include <chrono>
+#include "Cache.h"
+#include "Trace.h"
 
 
-using namespace std;
-using namespace std::chrono;
+// Demos check their results with check(); any failure makes main return non-zero
+int failedChecks = 0;
 
-template<typename T>
-class IEvictionPolicy{
-  public:
-    virtual void keyAccessed(const T& key){};
-    virtual T evict() = 0;
-    virtual ~IEvictionPolicy() = default;
-};
+bool check(bool ok, const string& what){
+    if( !ok ){
+        cout << "FAILED: " << what << endl;
+        failedChecks++;
+    }
+    return ok;
+}
 
+// Runs a mixed 80% get / 20% put workload from several threads and reports ops/s.
+// A single shard behaves like one global mutex around Cache and serves as the baseline.
+double measureShardedThroughput(size_t shardCount, int threadCount, int opsPerThread){
+    // Leave headroom so uneven shard fill never evicts keys the workload reads back
+    const int keySpace = 1 << 16;
+    ShardedCache<int, int> cache(shardCount, 2 * keySpace,
+        []{ return make_unique<HashMapStorage<int, int>>(); },
+        []{ return make_unique<LRUEvictionPolicy<int>>(); });
+    for( int key = 0; key < keySpace; key++ ){
+        cache.put(key, key);
+    }
 
-template<typename T>
-class LRUEvictionPolicy : public IEvictionPolicy<T>{
-private:
-    list<T> keyList;
-    unordered_map<T, typename list<T> :: iterator> keyMap;
-    
-public:
-    void keyAccessed(const T& key) override{
-        if( keyMap.find(key) != keyMap.end() ){
-            keyList.erase(keyMap[key]);
-        }
-        keyList.push_front(key);
-        keyMap[key] = keyList.begin();
+    auto start = steady_clock::now();
+    vector<thread> workers;
+    for( int t = 0; t < threadCount; t++ ){
+        workers.emplace_back([&cache, t, opsPerThread, keySpace]{
+            mt19937 rng(t + 1);
+            uniform_int_distribution<int> keyDist(0, keySpace - 1);
+            long long checksum = 0;
+            for( int i = 0; i < opsPerThread; i++ ){
+                int key = keyDist(rng);
+                if( i % 5 == 0 ){
+                    cache.put(key, i);
+                } else {
+                    checksum += cache.get(key);
+                }
+            }
+            if( checksum == -1 ) cout << "";
+        });
     }
-    
-    T evict() override {
-        if( keyList.empty() ){
-            throw runtime_error("No item to evict");
-        }
-        T lastKey = keyList.back();
-        keyList.pop_back();
-        keyMap.erase(lastKey);
-        
-        return lastKey;
+    for( auto& worker : workers ){
+        worker.join();
     }
-};
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    return threadCount * static_cast<double>(opsPerThread) / seconds;
+}
 
-template<typename T, typename V >
-class IStorage{
-public:
-    virtual void add(const T& key, const V& val) = 0;
-    virtual V get(const T& key) = 0;
-    virtual void remove(const T& Key) = 0;
-    virtual bool exists(const T& key) = 0;
-    virtual size_t size() const = 0;
-    
-    virtual ~IStorage() = default;
-};
+void runShardedThroughputDemo(){
+    const int opsPerThread = 200000;
+    cout << "threads, global-lock ops/s, 16-shard ops/s" << endl;
+    for( int threads : {1, 2, 4, 8} ){
+        double global = measureShardedThroughput(1, threads, opsPerThread);
+        double sharded = measureShardedThroughput(16, threads, opsPerThread);
+        cout << threads << ", " << fixed << setprecision(0) << global << ", " << sharded << endl;
+    }
+}
 
-template<typename T, typename V>
-class HashMapStorage : public IStorage<T, V> {
-private:
-    unordered_map<T, V> data;
+// Compares Cache backed by HashMapStorage + LRUEvictionPolicy against the fused LRUCacheEngine.
+void runLRUEngineBenchmark(){
+    const int capacity = 1 << 16;
+    const int ops = 1000000;
+    auto separate = []{ return Cache<int, int>(make_unique<HashMapStorage<int, int>>(), make_unique<LRUEvictionPolicy<int>>(), capacity); };
+    auto fused = []{ return Cache<int, int>(make_unique<LRUCacheEngine<int, int>>(), capacity); };
 
-public:
-    void add(const T& key, const V& val) override{
-        data[key] = val;
+    auto measure = [&](auto makeCache){
+        // Puts over twice the capacity, so about half of them miss and evict
+        Cache<int, int> churn = makeCache();
+        mt19937 rng(7);
+        uniform_int_distribution<int> wideKeys(0, 2 * capacity - 1);
+        auto start = steady_clock::now();
+        for( int i = 0; i < ops; i++ ){
+            churn.put(wideKeys(rng), i);
+        }
+        double putNs = duration<double, nano>(steady_clock::now() - start).count() / ops;
+
+        // Gets over a fully resident key range, so every lookup hits
+        Cache<int, int> warm = makeCache();
+        for( int key = 0; key < capacity; key++ ){
+            warm.put(key, key);
+        }
+        uniform_int_distribution<int> residentKeys(0, capacity - 1);
+        long long checksum = 0;
+        start = steady_clock::now();
+        for( int i = 0; i < ops; i++ ){
+            checksum += warm.get(residentKeys(rng));
+        }
+        double getNs = duration<double, nano>(steady_clock::now() - start).count() / ops;
+        if( checksum == -1 ) cout << "";
+        return make_pair(putNs, getNs);
+    };
+
+    auto [separatePut, separateGet] = measure(separate);
+    auto [fusedPut, fusedGet] = measure(fused);
+    cout << "engine, put ns/op, get ns/op" << endl;
+    cout << fixed << setprecision(1);
+    cout << "HashMapStorage+LRUEvictionPolicy, " << separatePut << ", " << separateGet << endl;
+    cout << "LRUCacheEngine, " << fusedPut << ", " << fusedGet << endl;
+}
+
+// Looks up std::string values with a 40% miss rate through each lookup API.
+void runLookupApiBenchmark(){
+    const int capacity = 1 << 14;
+    const int ops = 500000;
+    Cache<int, string> cache(make_unique<HashMapStorage<int, string>>(), make_unique<LRUEvictionPolicy<int>>(), capacity);
+    for( int key = 0; key < capacity; key++ ){
+        cache.put(key, "value-for-key-" + to_string(key) + "-padded-past-sso");
     }
-     V get(const T& key) override{
-        if (!exists(key)) {
-            throw runtime_error("Key not found in HashMap Cache");
+    // Keys at or above capacity were never inserted: 40% of the range misses
+    uniform_int_distribution<int> keys(0, capacity * 5 / 3 - 1);
+
+    auto measure = [&](auto lookup){
+        mt19937 rng(11);
+        size_t bytes = 0;
+        auto start = steady_clock::now();
+        for( int i = 0; i < ops; i++ ){
+            bytes += lookup(keys(rng));
         }
-        return data[key];
-     }
-     
-    void remove(const T& key) override{
-        data.erase(key);
+        if( bytes == 0 ) cout << "";
+        return duration<double, nano>(steady_clock::now() - start).count() / ops;
+    };
+
+    double throwing = measure([&](int key) -> size_t {
+        try{
+            return cache.get(key).size();
+        } catch( const runtime_error& ){
+            return 0;
+        }
+    });
+    double optionalCopy = measure([&](int key) -> size_t {
+        auto val = cache.tryGet(key);
+        return val ? val->size() : 0;
+    });
+    double pointer = measure([&](int key) -> size_t {
+        const string* val = cache.getPtr(key);
+        return val ? val->size() : 0;
+    });
+    cout << "lookup, ns/op" << endl;
+    cout << fixed << setprecision(1);
+    cout << "get + catch, " << throwing << endl;
+    cout << "tryGet, " << optionalCopy << endl;
+    cout << "getPtr, " << pointer << endl;
+}
+
+// Key 1 is touched last but expires first. Because expired entries are reclaimed before the
+// capacity check, inserting key 3 must not evict the still-live key 2.
+void runTTLExpirationDemo(){
+    Cache<int, string> ttlCache(make_unique<TTLHashMapStorage<int, string>>(milliseconds(50)), make_unique<LRUEvictionPolicy<int>>(), 2);
+    ttlCache.put(1, "one");
+    this_thread::sleep_for(milliseconds(30));
+    ttlCache.put(2, "two");
+    ttlCache.get(1);
+    this_thread::sleep_for(milliseconds(30));
+    ttlCache.put(3, "three");
+    bool live1 = ttlCache.tryGet(1).has_value(), live2 = ttlCache.tryGet(2).has_value(), live3 = ttlCache.tryGet(3).has_value();
+    cout << "TTL cache: key 1 " << (live1 ? "live" : "expired") << ", key 2 " << (live2 ? "live" : "evicted")
+         << ", key 3 " << (live3 ? "live" : "evicted") << endl;
+    check(!live1 && live2 && live3, "expired key reclaimed before the capacity check");
+
+    // Many keys expiring at once are reclaimed by the wheel without any lookups, in slices: the
+    // TTL puts them on the wheel's second level, so one slice must not cascade them all either
+    TTLHashMapStorage<int, int> bulk(milliseconds(70));
+    for( int key = 0; key < 100000; key++ ){
+        bulk.add(key, key);
     }
-    
-    bool exists(const T& key) override{
-        return data.find(key) != data.end();
+    this_thread::sleep_for(milliseconds(80));
+    size_t slice = bulk.reclaimExpired(64);
+    size_t backlog = bulk.size();
+    bulk.reclaimExpired();
+    cout << "TTL storage: one slice reclaimed " << slice << ", backlog " << backlog << ", live entries after draining: " << bulk.size() << endl;
+    check(slice <= 64 && backlog >= 100000 - 64, "reclaimExpired stays within its budget");
+    check(bulk.size() == 0, "every expired entry reclaimed");
+}
+
+// Mixes short and long per-key TTLs, then serves a stale value while one refresh runs in the background.
+void runPerKeyTTLDemo(){
+    Cache<string, string> sessions(make_unique<TTLHashMapStorage<string, string>>(hours(1)), make_unique<LRUEvictionPolicy<string>>(), 8);
+    sessions.put("short", "expires soon", milliseconds(20));
+    sessions.put("long", "uses the default hour");
+    this_thread::sleep_for(milliseconds(30));
+    cout << "per-key TTL: short " << (sessions.tryGet("short") ? "live" : "expired")
+         << ", long " << (sessions.tryGet("long") ? "live" : "expired") << endl;
+
+    atomic<int> reloads{0};
+    auto slowReload = [&reloads](const string& key){
+        this_thread::sleep_for(milliseconds(50));
+        return key + "-v" + to_string(++reloads + 1);
+    };
+    TTLHashMapStorage<string, string> swr(milliseconds(20), seconds(1), slowReload);
+    swr.add("config", "config-v1");
+    this_thread::sleep_for(milliseconds(30));
+
+    auto start = steady_clock::now();
+    string stale;
+    for( int i = 0; i < 100; i++ ){
+        stale = swr.get("config");
     }
-     size_t size() const override{
-         return data.size();
-     }
-};
+    double readMs = duration<double, milli>(steady_clock::now() - start).count();
+    this_thread::sleep_for(milliseconds(80));
+    string refreshed = swr.get("config");
+    cout << "stale-while-revalidate: 100 stale reads of " << stale << " took " << fixed << setprecision(2) << readMs
+         << " ms, " << reloads << " refresh, then " << refreshed << endl;
+    check(stale == "config-v1" && reloads == 1 && refreshed == "config-v2", "one refresh for many stale reads");
 
-// TTL-enabled Storage
-template<typename T, typename V>
-class TTLHashMapStorage : public IStorage<T, V> {
-private:
-    unordered_map<T, pair<V, time_point<steady_clock>>> data; // Pair of value and expiration time
-    milliseconds ttl; // Default TTL for all keys
+    // A put or remove of a stale key only checks liveness and must not start a refresh.
+    // Destroying the storage waits for any refresh it started, so the count is final after the scope.
+    atomic<int> writeRefreshes{0};
+    {
+        auto countingReload = [&writeRefreshes](const string& key){
+            writeRefreshes++;
+            return key;
+        };
+        Cache<string, string> writes(make_unique<TTLHashMapStorage<string, string>>(milliseconds(20), seconds(1), countingReload),
+                                     make_unique<LRUEvictionPolicy<string>>(), 8);
+        writes.put("a", "1");
+        writes.put("b", "1");
+        this_thread::sleep_for(milliseconds(30));
+        writes.put("a", "2");
+        writes.remove("b");
+    }
+    check(writeRefreshes == 0, "puts and removes of stale keys start no refresh");
+}
 
-public:
-    // Constructor with TTL
-    TTLHashMapStorage(milliseconds _ttl) : ttl(_ttl) {}
+// A Zipf workload interrupted by large one-off scans
+vector<int> zipfWithScansTrace(){
+    ZipfGenerator zipf(100000, 0.9);
+    mt19937 rng(3);
+    vector<int> trace;
+    int nextScanKey = 1 << 24;
+    for( int phase = 0; phase < 10; phase++ ){
+        for( int i = 0; i < 50000; i++ ){
+            trace.push_back(static_cast<int>(zipf(rng)));
+        }
+        for( int i = 0; i < 10000; i++ ){
+            trace.push_back(nextScanKey++);
+        }
+    }
+    return trace;
+}
 
-    void add(const T& key, const V& val) override {
-        data[key] = { val, steady_clock::now() + ttl };
+// Alternates a small hot Zipf set with a loop slightly larger than the cache, which defeats LRU
+vector<int> recencyFrequencyTrace(size_t capacity){
+    ZipfGenerator zipf(capacity / 2, 1.0);
+    mt19937 rng(5);
+    vector<int> trace;
+    int loopLength = static_cast<int>(capacity * 3 / 2);
+    for( int phase = 0; phase < 10; phase++ ){
+        for( int i = 0; i < 30000; i++ ){
+            trace.push_back(static_cast<int>(zipf(rng)));
+        }
+        for( int lap = 0; lap < 5; lap++ ){
+            for( int key = 0; key < loopLength; key++ ){
+                trace.push_back((1 << 24) + key);
+            }
+        }
     }
+    return trace;
+}
 
-    V get(const T& key) override {
-        if (!exists(key)) {
-            throw runtime_error("Key not found in TTL HashMap Cache");
+// Replays a key trace, filling the cache on every miss, and reports the hit ratio
+double replayTrace(const vector<int>& trace, IEvictionPolicy<int>* policy, size_t capacity){
+    Cache<int, int> cache(make_unique<HashMapStorage<int, int>>(), unique_ptr<IEvictionPolicy<int>>(policy), capacity);
+    long long hits = 0;
+    for( int key : trace ){
+        if( cache.getPtr(key) ){
+            hits++;
+        } else {
+            cache.put(key, key);
         }
-        return data[key].first;
     }
+    return static_cast<double>(hits) / trace.size();
+}
 
-    void remove(const T& key) override {
-        data.erase(key);
+void runHitRatioDemo(){
+    const size_t capacity = 2000;
+    vector<int> scans = zipfWithScansTrace();
+    vector<int> mixed = recencyFrequencyTrace(capacity);
+    vector<pair<string, function<IEvictionPolicy<int>*()>>> policies = {
+        {"LRU", []{ return new LRUEvictionPolicy<int>(); }},
+        {"CLOCK", [&]{ return new ClockEvictionPolicy<int>(capacity); }},
+        {"W-TinyLFU", [&]{ return new WTinyLFUEvictionPolicy<int>(capacity); }},
+        {"ARC", [&]{ return new ARCEvictionPolicy<int>(capacity); }},
+        {"2Q", [&]{ return new TwoQueueEvictionPolicy<int>(capacity); }},
+    };
+    cout << "policy, hit ratio Zipf(0.9) + scans, hit ratio hot set + loops" << endl;
+    cout << fixed << setprecision(3);
+    for( auto& [name, makePolicy] : policies ){
+        cout << name << ", " << replayTrace(scans, makePolicy(), capacity) << ", " << replayTrace(mixed, makePolicy(), capacity) << endl;
     }
+}
 
-    bool exists(const T& key) override {
-        auto it = data.find(key);
-        if (it == data.end()) return false;
+// On the hot set + loops trace LRU misses every loop access, so the adaptive policy must leave
+// LRU for a candidate that survives the loops and end up ahead of it
+void runAdaptivePolicyCheck(){
+    const size_t capacity = 2000;
+    vector<int> mixed = recencyFrequencyTrace(capacity);
+    auto policy = make_unique<AdaptiveEvictionPolicy<int>>(capacity, AdaptiveEvictionPolicy<int>::standardCandidates());
+    AdaptiveEvictionPolicy<int>* adaptive = policy.get();
+    Cache<int, int> cache(make_unique<HashMapStorage<int, int>>(), move(policy), capacity);
+    long long hits = 0;
+    for( int key : mixed ){
+        if( cache.getPtr(key) ){
+            hits++;
+        } else {
+            cache.put(key, key);
+        }
+    }
+    double adaptiveRatio = static_cast<double>(hits) / mixed.size();
+    double lruRatio = replayTrace(mixed, new LRUEvictionPolicy<int>(), capacity);
+    cout << "adaptive: hit ratio hot set + loops " << fixed << setprecision(3) << adaptiveRatio << " (LRU " << lruRatio << "), live "
+         << adaptive->livePolicyName() << " after " << adaptive->switchCount() << " switches" << endl;
+    check(adaptive->switchCount() > 0 && adaptive->livePolicyName() != "lru", "adaptive policy switches away from LRU on loops");
+    check(adaptiveRatio > lruRatio + 0.05, "adaptive policy beats LRU on loops");
+}
 
-        // Check if key has expired
-        if (steady_clock::now() > it->second.second) {
-            data.erase(it);  // Remove expired key
-            return false;
+// StaticCache composes the same storage and policy at compile time, so it must make exactly
+// the decisions Cache makes through virtual calls
+void runStaticCacheCheck(){
+    const size_t capacity = 2000;
+    vector<int> trace = zipfWithScansTrace();
+    auto replay = [&](auto& cache){
+        size_t hits = 0;
+        for( int key : trace ){
+            if( const int* val = cache.getPtr(key) ){
+                hits += *val == key;
+            } else {
+                cache.put(key, key);
+            }
         }
+        return hits;
+    };
 
-        return true;
+    Cache<int, int> dynamicLRU(make_unique<HashMapStorage<int, int>>(), make_unique<LRUEvictionPolicy<int>>(), capacity);
+    StaticCache<int, int, HashMapStorage<int, int>, LRUEvictionPolicy<int>> staticLRU(capacity);
+    Cache<int, int> dynamicEngine(make_unique<LRUCacheEngine<int, int>>(), capacity);
+    StaticCache<int, int, LRUCacheEngine<int, int>> staticEngine(capacity);
+    size_t expected = replay(dynamicLRU);
+    size_t staticHits = replay(staticLRU);
+    size_t dynamicEngineHits = replay(dynamicEngine);
+    size_t staticEngineHits = replay(staticEngine);
+    cout << "static cache: hits of Cache " << expected << ", StaticCache " << staticHits << ", engine " << dynamicEngineHits
+         << " / " << staticEngineHits << endl;
+    check(staticHits == expected && staticLRU.size() == dynamicLRU.size(), "StaticCache matches Cache with hash + lru");
+    check(dynamicEngineHits == expected && staticEngineHits == expected, "LRU engines match hash + lru");
+}
+
+// 99% reads over a resident key set: LRU hits need the shard lock exclusively,
+// CLOCK hits share it.
+double measureReadHeavyThroughput(bool useClock, int threadCount, int opsPerThread){
+    const int keySpace = 1 << 16;
+    const size_t shardCount = 4;
+    size_t perShard = 2 * keySpace / shardCount;
+    ShardedCache<int, int> cache(shardCount, 2 * keySpace,
+        []{ return make_unique<HashMapStorage<int, int>>(); },
+        [useClock, perShard]() -> unique_ptr<IEvictionPolicy<int>> {
+            if( useClock ) return make_unique<ClockEvictionPolicy<int>>(perShard);
+            return make_unique<LRUEvictionPolicy<int>>();
+        });
+    for( int key = 0; key < keySpace; key++ ){
+        cache.put(key, key);
     }
 
-    size_t size() const override {
-        return data.size();
+    auto start = steady_clock::now();
+    vector<thread> workers;
+    for( int t = 0; t < threadCount; t++ ){
+        workers.emplace_back([&cache, t, opsPerThread, keySpace]{
+            mt19937 rng(t + 1);
+            uniform_int_distribution<int> keyDist(0, keySpace - 1);
+            long long checksum = 0;
+            for( int i = 0; i < opsPerThread; i++ ){
+                int key = keyDist(rng);
+                if( i % 100 == 0 ){
+                    cache.put(key, i);
+                } else {
+                    checksum += cache.getOrDefault(key, 0);
+                }
+            }
+            if( checksum == -1 ) cout << "";
+        });
     }
-};
+    for( auto& worker : workers ){
+        worker.join();
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    return threadCount * static_cast<double>(opsPerThread) / seconds;
+}
 
+void runClockReadHeavyBenchmark(){
+    const int opsPerThread = 200000;
+    cout << "threads, LRU ops/s, CLOCK ops/s (99% reads, 4 shards)" << endl;
+    for( int threads : {1, 2, 4, 8} ){
+        double lru = measureReadHeavyThroughput(false, threads, opsPerThread);
+        double clock = measureReadHeavyThroughput(true, threads, opsPerThread);
+        cout << threads << ", " << fixed << setprecision(0) << lru << ", " << clock << endl;
+    }
+}
+// Churns an LRU cache well past its capacity and counts heap allocations once it is warm:
+// std::allocator pays for two nodes per miss, the NodePool-backed containers pay nothing.
+void runPoolAllocatorDemo(){
+    const size_t capacity = 4096;
+    const int ops = 200000;
+    auto churn = [&](Cache<int, int>& cache){
+        mt19937 rng(13);
+        uniform_int_distribution<int> keys(0, 4 * capacity - 1);
+        for( int i = 0; i < ops; i++ ){
+            cache.put(keys(rng), i);
+        }
+    };
 
+    auto counter = make_shared<size_t>(0);
+    Cache<int, int> counted(
+        make_unique<HashMapStorage<int, int, CountingAllocator<int>>>(capacity, CountingAllocator<int>(counter)),
+        make_unique<LRUEvictionPolicy<int, CountingAllocator<int>>>(capacity, CountingAllocator<int>(counter)), capacity);
+    churn(counted);
+    size_t countedBefore = *counter;
+    churn(counted);
+    size_t countedSteady = *counter - countedBefore;
 
-template<typename T, typename V>
-class Cache{
-private:
-    unique_ptr<IStorage<T, V>> storage;
-    unique_ptr<IEvictionPolicy<T>> policy;
-    size_t capacity;
-    
+    auto pool = make_shared<NodePool>(capacity);
+    Cache<int, int> pooled(
+        make_unique<HashMapStorage<int, int, PoolAllocator<int>>>(capacity, PoolAllocator<int>(pool)),
+        make_unique<LRUEvictionPolicy<int, PoolAllocator<int>>>(capacity, PoolAllocator<int>(pool)), capacity);
+    churn(pooled);
+    size_t pooledBefore = pool->heapAllocationCount();
+    churn(pooled);
+    size_t pooledSteady = pool->heapAllocationCount() - pooledBefore;
+
+    auto enginePool = make_shared<NodePool>(capacity);
+    Cache<int, int> engine(make_unique<LRUCacheEngine<int, int, PoolAllocator<int>>>(capacity, PoolAllocator<int>(enginePool)), capacity);
+    churn(engine);
+    size_t engineBefore = enginePool->heapAllocationCount();
+    churn(engine);
+    size_t engineSteady = enginePool->heapAllocationCount() - engineBefore;
+
+    cout << "allocator, heap allocations in " << ops << " steady-state puts" << endl;
+    cout << "std::allocator, " << countedSteady << endl;
+    cout << "NodePool, " << pooledSteady << (pooledSteady == 0 ? " (ok)" : " (FAILED)") << endl;
+    cout << "NodePool + LRUCacheEngine, " << engineSteady << (engineSteady == 0 ? " (ok)" : " (FAILED)") << endl;
+}
+
+// Caches string values between 10 B and 200 KB under a 1 MB byte budget
+void runWeightedCapacityDemo(){
+    const size_t budget = 1 << 20;
+    auto bytes = [](const string& key, const string& val){ return key.size() + val.size(); };
+    Cache<string, string> cache(make_unique<HashMapStorage<string, string>>(), make_unique<LRUEvictionPolicy<string>>(), budget, bytes);
+
+    mt19937 rng(17);
+    uniform_int_distribution<int> exponent(1, 5);
+    size_t peak = 0;
+    for( int i = 0; i < 2000; i++ ){
+        size_t length = static_cast<size_t>(2 * pow(10.0, exponent(rng)));
+        cache.put("key" + to_string(i), string(length, 'x'));
+        peak = max(peak, cache.weightedSize());
+    }
+    bool accepted = cache.put("huge", string(2 << 20, 'x'));
+    cout << "weighted cache: " << cache.size() << " entries using " << cache.weightedSize() << " of " << budget
+         << " bytes (peak " << peak << "), 2 MB value " << (accepted ? "accepted" : "rejected") << endl;
+    check(peak <= budget && !accepted, "weighted cache stays within its byte budget");
+}
+
+// Growing a resident value must evict other keys, never the one being written, even under
+// policies that can pick a key just touched: CLOCK once a sweep has cleared every reference
+// bit, ARC when its recency target exceeds T1 and T2 holds only that key
+void runWeightedUpdateCheck(){
+    auto bytes = [](const string&, const string& val){ return val.size(); };
+    Cache<string, string> clock(make_unique<HashMapStorage<string, string>>(), make_unique<ClockEvictionPolicy<string>>(4), 10, bytes);
+    clock.put("a", string(4, 'a'));
+    clock.put("b", string(4, 'b'));
+    clock.get("b");
+    bool clockStored = clock.put("a", string(7, 'a'));
+    bool clockKept = clockStored && clock.tryGet("a") == string(7, 'a') && clock.weightedSize() <= 10;
+
+    // x is evicted to the ghost list B1, and its return raises p to 1 and lands it in T2
+    Cache<string, string> arc(make_unique<HashMapStorage<string, string>>(), make_unique<ARCEvictionPolicy<string>>(4), 10, bytes);
+    for( string key : {"x", "y", "z", "x"} ){
+        arc.put(key, string(4, key[0]));
+    }
+    bool arcStored = arc.put("x", string(7, 'x'));
+    bool arcKept = arcStored && arc.tryGet("x") == string(7, 'x') && arc.weightedSize() <= 10;
+    cout << "weighted update: CLOCK " << (clockKept ? "kept" : "dropped") << " the grown value, ARC "
+         << (arcKept ? "kept" : "dropped") << " it" << endl;
+    check(clockKept, "CLOCK keeps a value it just grew");
+    check(arcKept, "ARC keeps a value it just grew");
+
+    bool rejected = false;
+    try{
+        ShardedCache<string, string> tooSmall(16, 8, bytes,
+            []{ return make_unique<HashMapStorage<string, string>>(); },
+            []{ return make_unique<LRUEvictionPolicy<string>>(); });
+    } catch( const invalid_argument& ){
+        rejected = true;
+    }
+    check(rejected, "ShardedCache rejects a weight budget smaller than its shard count");
+}
+
+// Fake slow backend that counts how often it is called
+class FakeBackend{
 public:
-    Cache(unique_ptr<IStorage<T, V>> _storage, unique_ptr<IEvictionPolicy<T>> _policy, size_t _capacity) : storage(move(_storage)), policy(move(_policy)), capacity(_capacity){}
-    
-    void put(const T& key, const V& val){
-        if( storage->exists(key) ){
-            storage->add(key, val);
-            policy->keyAccessed(key);
-            return;
-        }
-        if( storage->size() == capacity ){
-            T evictedKey = policy->evict();
-            storage->remove(evictedKey);
+    atomic<int> loads{0};
+    atomic<int> batchLoads{0};
+    atomic<bool> failing{false};
+
+    string load(int key){
+        loads++;
+        this_thread::sleep_for(milliseconds(20));
+        if( failing ){
+            throw runtime_error("backend unavailable");
         }
-        storage->add(key, val);
-        policy->keyAccessed(key);
+        return "value" + to_string(key);
     }
-    
-    V get(const T& key){
-        if( !storage->exists(key) ){
-            throw runtime_error("Key Not Found in the Cache");
+
+    unordered_map<int, string> loadAll(const vector<int>& keys){
+        batchLoads++;
+        this_thread::sleep_for(milliseconds(20));
+        unordered_map<int, string> values;
+        for( int key : keys ){
+            values[key] = "value" + to_string(key);
         }
-        policy->keyAccessed(key);
-        return storage->get(key);
+        return values;
     }
 };
 
+// 200 threads miss on the same hot key at once; the backend should see one load
+void runReadThroughDemo(){
+    FakeBackend backend;
+    ShardedCache<int, string> cache(4, 1000,
+        []{ return make_unique<HashMapStorage<int, string>>(); },
+        []{ return make_unique<LRUEvictionPolicy<int>>(); });
+    auto loader = [&](const int& key){ return backend.load(key); };
+
+    auto stampede = [&](int key){
+        atomic<int> errors{0};
+        vector<thread> callers;
+        for( int t = 0; t < 200; t++ ){
+            callers.emplace_back([&]{
+                try{
+                    cache.getOrLoad(key, loader);
+                } catch( const runtime_error& ){
+                    errors++;
+                }
+            });
+        }
+        for( auto& caller : callers ){
+            caller.join();
+        }
+        return errors.load();
+    };
+
+    stampede(42);
+    cout << "read-through: 200 concurrent misses, " << backend.loads << " backend load" << endl;
+
+    backend.failing = true;
+    int errors = stampede(7);
+    int failedLoads = backend.loads - 1;
+    backend.failing = false;
+    cache.getOrLoad(7, loader);
+    cout << "read-through: failed load seen by " << errors << " callers in " << failedLoads << " load(s), retried after failure: "
+         << (cache.tryGet(7) == "value7" ? "ok" : "missing") << endl;
+
+    {
+        BatchLoader<int, string> batcher([&](const vector<int>& keys){ return backend.loadAll(keys); }, milliseconds(5));
+        vector<shared_future<string>> results;
+        for( int key = 100; key < 200; key++ ){
+            results.push_back(cache.getOrLoadAsync(key, batcher));
+            results.push_back(cache.getOrLoadAsync(key, batcher));
+        }
+        size_t correct = 0;
+        for( size_t i = 0; i < results.size(); i++ ){
+            correct += results[i].get() == "value" + to_string(100 + i / 2);
+        }
+        cout << "batch loader: " << results.size() << " async lookups of 100 keys, " << correct << " correct, "
+             << backend.batchLoads << " loadAll call(s)" << endl;
+    }
+}
+
+
+// Readers race writers and removes on a small ConcurrentCache: every value read must belong to
+// its key, the cache must stay within capacity, and once the threads stop every replaced or
+// evicted node must be freed
+void runConcurrentCacheCheck(){
+    const int keySpace = 1000;
+    const size_t capacity = 256, shardCount = 8;
+    ConcurrentCache<int, string> cache(shardCount, capacity);
+    atomic<bool> stop{false};
+    atomic<size_t> reads{0}, corrupt{0};
+    vector<thread> workers;
+    for( int t = 0; t < 4; t++ ){
+        workers.emplace_back([&, t]{
+            mt19937 rng(t + 1);
+            uniform_int_distribution<int> keys(0, keySpace - 1);
+            size_t localReads = 0, localCorrupt = 0;
+            for( int version = 0; !stop.load(memory_order_relaxed); version++ ){
+                int key = keys(rng);
+                int roll = version % 10;
+                if( roll == 0 ){
+                    cache.put(key, to_string(key) + ":" + to_string(version));
+                } else if( roll == 1 ){
+                    cache.remove(key);
+                } else if( optional<string> val = cache.tryGet(key) ){
+                    localCorrupt += val->substr(0, val->find(':')) != to_string(key);
+                    localReads++;
+                }
+            }
+            reads += localReads;
+            corrupt += localCorrupt;
+        });
+    }
+    this_thread::sleep_for(milliseconds(300));
+    stop = true;
+    for( auto& worker : workers ){
+        worker.join();
+    }
+    size_t perShard = (capacity + shardCount - 1) / shardCount;
+    bool withinCapacity = cache.size() <= perShard * shardCount;
+    // With every reader gone, two epoch advances free everything still retired
+    for( int i = 0; i < 3; i++ ){
+        cache.reclaimRetired();
+    }
+    size_t leftover = cache.retiredCount();
+    cout << "concurrent cache: " << reads << " hits, " << corrupt << " wrong values, " << cache.size() << " entries, "
+         << leftover << " nodes unreclaimed" << endl;
+    check(corrupt == 0, "ConcurrentCache reads return their key's value");
+    check(withinCapacity, "ConcurrentCache stays within capacity");
+    check(leftover == 0, "ConcurrentCache frees every retired node");
+}
+
+// A put through the TieredCache must reach the L1 that cached the old value
+void runTieredInvalidationDemo(){
+    auto makeShared = []{
+        return make_unique<ShardedCache<int, string>>(4, 1000,
+            []{ return make_unique<HashMapStorage<int, string>>(); },
+            []{ return make_unique<LRUEvictionPolicy<int>>(); });
+    };
+
+    TieredCache<int, string> strict(makeShared());
+    strict.put(1, "old");
+    strict.get(1);
+    strict.get(1);
+    thread([&]{ strict.put(1, "new"); }).join();
+    TieredCacheStats stats = strict.stats();
+    cout << "tiered: read after another thread's put: " << strict.get(1) << ", L1 hits " << stats.l1Hits
+         << ", L2 hits " << stats.l2Hits << ", misses " << stats.misses << endl;
+
+    // Revalidating every 4th L1 hit allows up to 3 stale hits per thread after a write
+    TieredCache<int, string> relaxed(makeShared(), 64, 4);
+    relaxed.put(1, "old");
+    relaxed.get(1);
+    relaxed.put(1, "new");
+    int staleReads = 0;
+    while( relaxed.get(1) == "old" ){
+        staleReads++;
+    }
+    cout << "tiered: revalidateAfter 4, stale reads after a put: " << staleReads << endl;
+}
+
 
 int main() {
     auto hashStorage = make_unique<HashMapStorage<int, string>>();
@@ -175,5 +672,21 @@ int main() {
     lruCache.put(5, "five");
     cout << lruCache.get(4) << endl;
 
-    return 0;
+    runTTLExpirationDemo();
+    runPerKeyTTLDemo();
+    runHitRatioDemo();
+    runAdaptivePolicyCheck();
+    runStaticCacheCheck();
+    runPoolAllocatorDemo();
+    runWeightedCapacityDemo();
+    runWeightedUpdateCheck();
+    runReadThroughDemo();
+    runConcurrentCacheCheck();
+    runTieredInvalidationDemo();
+    runShardedThroughputDemo();
+    runClockReadHeavyBenchmark();
+    runLRUEngineBenchmark();
+    runLookupApiBenchmark();
+
+    return failedChecks ? 1 : 0;
 }
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "Epoch.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Build with -DCACHE_METRICS=1 to count hits, misses, puts, evictions, expirations and load
+// failures and to sample get/put latencies. Without it the hooks compile to nothing.
+#ifndef CACHE_METRICS
+#define CACHE_METRICS 0
+#endif
+
+constexpr bool cacheMetricsEnabled = CACHE_METRICS;
+
+// Latencies in power-of-two nanosecond buckets: bucket b holds values in [2^(b-1), 2^b)
+struct LatencyHistogram{
+    static constexpr size_t bucketCount = 64;
+
+    array<uint64_t, bucketCount> buckets{};
+    // Exact total of the sampled latencies, exported as the histogram's _sum
+    uint64_t sumNanos = 0;
+
+    static size_t bucketOf(uint64_t nanos){
+        return min<size_t>(bit_width(nanos), bucketCount - 1);
+    }
+
+    // Exclusive upper bound of a bucket, in nanoseconds
+    static uint64_t upperBound(size_t bucket){
+        return bucket >= 63 ? UINT64_MAX : uint64_t(1) << bucket;
+    }
+
+    uint64_t count() const{
+        return accumulate(buckets.begin(), buckets.end(), uint64_t(0));
+    }
+
+    // Upper bound of the bucket holding the given fraction of samples, so within 2x of the truth
+    uint64_t percentile(double fraction) const{
+        uint64_t total = count();
+        if( total == 0 ) return 0;
+        uint64_t rank = static_cast<uint64_t>(ceil(fraction * total));
+        uint64_t seen = 0;
+        for( size_t b = 0; b < bucketCount; b++ ){
+            seen += buckets[b];
+            if( seen >= max<uint64_t>(rank, 1) ){
+                return upperBound(b);
+            }
+        }
+        return upperBound(bucketCount - 1);
+    }
+
+    LatencyHistogram& operator+=(const LatencyHistogram& other){
+        for( size_t b = 0; b < bucketCount; b++ ){
+            buckets[b] += other.buckets[b];
+        }
+        sumNanos += other.sumNanos;
+        return *this;
+    }
+};
+
+struct CacheStats{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t puts = 0;
+    uint64_t evictions = 0;
+    uint64_t expirations = 0;
+    uint64_t loadFailures = 0;
+    // Sampled: one operation in CacheMetrics::latencySampleEvery per thread is timed
+    LatencyHistogram getLatency;
+    LatencyHistogram putLatency;
+
+    double hitRatio() const{
+        return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;
+    }
+
+    CacheStats& operator+=(const CacheStats& other){
+        hits += other.hits;
+        misses += other.misses;
+        puts += other.puts;
+        evictions += other.evictions;
+        expirations += other.expirations;
+        loadFailures += other.loadFailures;
+        getLatency += other.getLatency;
+        putLatency += other.putLatency;
+        return *this;
+    }
+};
+
+// Prometheus text exposition format, one metric family per counter and histogram
+inline string formatStats(const CacheStats& stats, const string& prefix = "cache"){
+    ostringstream out;
+    auto counter = [&](const string& name, uint64_t value){
+        out << "# TYPE " << prefix << "_" << name << "_total counter\n"
+            << prefix << "_" << name << "_total " << value << "\n";
+    };
+    auto histogram = [&](const string& name, const LatencyHistogram& latency){
+        string family = prefix + "_" + name + "_latency_ns";
+        out << "# TYPE " << family << " histogram\n";
+        uint64_t cumulative = 0;
+        size_t last = LatencyHistogram::bucketCount;
+        while( last > 0 && latency.buckets[last - 1] == 0 ) last--;
+        for( size_t b = 0; b < last; b++ ){
+            cumulative += latency.buckets[b];
+            out << family << "_bucket{le=\"" << LatencyHistogram::upperBound(b) << "\"} " << cumulative << "\n";
+        }
+        out << family << "_bucket{le=\"+Inf\"} " << latency.count() << "\n"
+            << family << "_sum " << latency.sumNanos << "\n"
+            << family << "_count " << latency.count() << "\n";
+    };
+    counter("hits", stats.hits);
+    counter("misses", stats.misses);
+    counter("puts", stats.puts);
+    counter("evictions", stats.evictions);
+    counter("expirations", stats.expirations);
+    counter("load_failures", stats.loadFailures);
+    histogram("get", stats.getLatency);
+    histogram("put", stats.putLatency);
+    return out.str();
+}
+
+// Counters and latency histograms sharded per thread: every thread writes only its own
+// cache-line-aligned block (allocated on its first event), so instrumented hits that run
+// concurrently under a shared lock never contend. stats() sums the blocks.
+class CacheMetrics{
+public:
+    enum Counter{ Hits, Misses, Puts, Evictions, Expirations, LoadFailures, CounterCount };
+    enum Operation{ Get, Put };
+
+    static constexpr uint32_t latencySampleEvery = 16;
+
+private:
+    struct alignas(64) ThreadBlock{
+        array<atomic<uint64_t>, CounterCount> counters{};
+        array<array<atomic<uint64_t>, LatencyHistogram::bucketCount>, 2> latency{};
+        array<atomic<uint64_t>, 2> latencySum{};
+        // Separate per operation, so alternating gets and puts do not alias with the sampling
+        array<uint32_t, 2> sampleTicks{};
+    };
+
+    unique_ptr<atomic<ThreadBlock*>[]> blocks = make_unique<atomic<ThreadBlock*>[]>(maxEpochThreads);
+
+    ThreadBlock& local(){
+        atomic<ThreadBlock*>& slot = blocks[EpochThreadRegistry::index()];
+        ThreadBlock* block = slot.load(memory_order_relaxed);
+        if( !block ){
+            block = new ThreadBlock();
+            slot.store(block, memory_order_release);
+        }
+        return *block;
+    }
+
+    // Single writer per block, so a relaxed load and store is enough
+    static void bump(atomic<uint64_t>& value, uint64_t by = 1){
+        value.store(value.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+
+public:
+    // Times the enclosing scope if this operation was picked for sampling. Counting through
+    // the timer reuses its lookup of the thread's block.
+    class Timer{
+    private:
+        ThreadBlock& block;
+        atomic<uint64_t>* buckets = nullptr;
+        atomic<uint64_t>* sum = nullptr;
+        steady_clock::time_point start;
+
+    public:
+        Timer(CacheMetrics& metrics, Operation operation) : block(metrics.local()){
+            if( ++block.sampleTicks[operation] % latencySampleEvery == 0 ){
+                buckets = block.latency[operation].data();
+                sum = &block.latencySum[operation];
+                start = steady_clock::now();
+            }
+        }
+
+        ~Timer(){
+            if( buckets ){
+                uint64_t nanos = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+                bump(buckets[LatencyHistogram::bucketOf(nanos)]);
+                bump(*sum, nanos);
+            }
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        void count(Counter counter){
+            bump(block.counters[counter]);
+        }
+    };
+
+    CacheMetrics() = default;
+    CacheMetrics(const CacheMetrics&) = delete;
+    CacheMetrics& operator=(const CacheMetrics&) = delete;
+
+    ~CacheMetrics(){
+        for( size_t i = 0; i < maxEpochThreads; i++ ){
+            delete blocks[i].load(memory_order_relaxed);
+        }
+    }
+
+    void count(Counter counter, uint64_t by = 1){
+        bump(local().counters[counter], by);
+    }
+
+    Timer time(Operation operation){
+        return Timer(*this, operation);
+    }
+
+    // Blocks of threads that are still running are read as of some recent point
+    CacheStats stats() const{
+        CacheStats total;
+        for( size_t i = 0, threads = EpochThreadRegistry::count(); i < threads; i++ ){
+            const ThreadBlock* block = blocks[i].load(memory_order_acquire);
+            if( !block ) continue;
+            total.hits += block->counters[Hits].load(memory_order_relaxed);
+            total.misses += block->counters[Misses].load(memory_order_relaxed);
+            total.puts += block->counters[Puts].load(memory_order_relaxed);
+            total.evictions += block->counters[Evictions].load(memory_order_relaxed);
+            total.expirations += block->counters[Expirations].load(memory_order_relaxed);
+            total.loadFailures += block->counters[LoadFailures].load(memory_order_relaxed);
+            for( size_t b = 0; b < LatencyHistogram::bucketCount; b++ ){
+                total.getLatency.buckets[b] += block->latency[Get][b].load(memory_order_relaxed);
+                total.putLatency.buckets[b] += block->latency[Put][b].load(memory_order_relaxed);
+            }
+            total.getLatency.sumNanos += block->latencySum[Get].load(memory_order_relaxed);
+            total.putLatency.sumNanos += block->latencySum[Put].load(memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+// Stand-in with the same interface for builds without CACHE_METRICS; every call is a no-op
+class DisabledCacheMetrics{
+public:
+    struct Timer{
+        void count(CacheMetrics::Counter){}
+    };
+
+    void count(CacheMetrics::Counter, uint64_t = 1){}
+
+    Timer time(CacheMetrics::Operation){
+        return {};
+    }
+
+    CacheStats stats() const{
+        return {};
+    }
+};
+
+using Metrics = conditional_t<cacheMetricsEnabled, CacheMetrics, DisabledCacheMetrics>;
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "Epoch.h"
+#include "HashedKey.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+struct MissRatioPoint{
+    size_t capacity;
+    double missRatio;
+};
+
+// Online estimate of the LRU miss ratio at every cache size up to maxCapacity entries, built
+// from reuse distances of a spatially sampled subset of keys (fixed-size SHARDS). A key is
+// sampled iff its hash is below a threshold; the threshold starts at the whole hash range and
+// drops to the largest sampled hash whenever more than maxSamples keys are tracked, so memory
+// stays constant however many distinct keys the traffic has. A sampled reference counts as
+// 1 / rate references, and its distance (distinct sampled keys since the key's last reference)
+// is scaled by 1 / rate as well. Every reference is counted, sampled or not.
+// Thread-safe: keys outside the sample cost a per-thread count and one hash, sampled keys take a lock.
+template<typename T>
+class MissRatioCurveSampler{
+private:
+    struct Sample{
+        uint32_t slot;
+        uint64_t hash;
+    };
+
+    struct alignas(64) ReferenceCount{
+        atomic<uint64_t> value{0};
+    };
+
+    size_t maxCapacity;
+    size_t binWidth;
+    size_t maxSamples;
+    hash<T> hasher;
+    atomic<uint64_t> threshold{UINT64_MAX};
+    // References seen, sampled or not, counted per thread so busy callers never share a line
+    unique_ptr<ReferenceCount[]> referenceCounts = make_unique<ReferenceCount[]>(maxEpochThreads);
+
+    mutable mutex lock;
+    unordered_map<T, Sample, KeyHash<T>, KeyEqual<T>> samples;
+    // Max-heap of the sampled keys' hashes, to find the one to drop when the sample is full
+    vector<pair<uint64_t, T>> byHash;
+    // Fenwick tree over time slots marking each sampled key's last reference, so a reuse
+    // distance is the number of marks after the key's slot. Slots are renumbered once they
+    // run out, keeping the tree at twice the sample size.
+    vector<uint32_t> marks;
+    uint32_t nextSlot = 0;
+    // Estimated references per distance bin; first references and distances of maxCapacity
+    // or more are misses at every size and go to `beyond`
+    vector<double> histogram;
+    double beyond = 0;
+
+    // SplitMix64 step over std::hash, so sampling does not depend on how the keys are numbered
+    static uint64_t mix(size_t hash){
+        uint64_t h = static_cast<uint64_t>(hash) + 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
+    }
+
+    double rate() const{
+        return static_cast<double>(threshold.load(memory_order_relaxed)) / 18446744073709551616.0;
+    }
+
+    static bool hashLess(const pair<uint64_t, T>& a, const pair<uint64_t, T>& b){
+        return a.first < b.first;
+    }
+
+    void mark(uint32_t slot, int delta){
+        for( size_t i = slot + 1; i < marks.size(); i += i & -i ){
+            marks[i] += delta;
+        }
+    }
+
+    // Marks in slots 0..slot
+    size_t marksUpTo(uint32_t slot) const{
+        size_t count = 0;
+        for( size_t i = slot + 1; i > 0; i -= i & -i ){
+            count += marks[i];
+        }
+        return count;
+    }
+
+    uint32_t takeSlot(){
+        if( nextSlot + 1 == marks.size() ){
+            renumberSlots();
+        }
+        mark(nextSlot, 1);
+        return nextSlot++;
+    }
+
+    // Gives the sampled keys slots 0..n-1 in the order of their last references
+    void renumberSlots(){
+        vector<Sample*> order;
+        order.reserve(samples.size());
+        for( auto& [key, sample] : samples ){
+            order.push_back(&sample);
+        }
+        sort(order.begin(), order.end(), [](Sample* a, Sample* b){ return a->slot < b->slot; });
+        fill(marks.begin(), marks.end(), 0);
+        for( uint32_t i = 0; i < order.size(); i++ ){
+            order[i]->slot = i;
+            mark(i, 1);
+        }
+        nextSlot = static_cast<uint32_t>(order.size());
+    }
+
+    // Drops the sampled key with the largest hash and lowers the threshold to it
+    void shrinkSample(){
+        pop_heap(byHash.begin(), byHash.end(), hashLess);
+        auto [largest, key] = move(byHash.back());
+        byHash.pop_back();
+        threshold.store(largest, memory_order_relaxed);
+        auto it = samples.find(key);
+        if( it != samples.end() ){
+            mark(it->second.slot, -1);
+            samples.erase(it);
+        }
+    }
+
+    uint64_t totalReferences() const{
+        uint64_t total = 0;
+        for( size_t i = 0, threads = EpochThreadRegistry::count(); i < threads; i++ ){
+            total += referenceCounts[i].value.load(memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Misses over all references, not over the estimated count: the difference (the sample
+    // drew more or fewer references than its rate predicts, e.g. a hot key was or was not
+    // sampled) is taken as hits at the shortest distance, as in SHARDS_adj
+    double missRatioFromBin(size_t bin) const{
+        double misses = beyond;
+        for( size_t b = bin; b < histogram.size(); b++ ){
+            misses += histogram[b];
+        }
+        uint64_t total = totalReferences();
+        return total ? min(misses / total, 1.0) : 1;
+    }
+
+    // Key is T or HashedKey<T>
+    template<typename Key>
+    void recordHashed(const Key& key, uint64_t h){
+        atomic<uint64_t>& count = referenceCounts[EpochThreadRegistry::index()].value;
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        if( h >= threshold.load(memory_order_relaxed) ) return;
+        lock_guard<mutex> guard(lock);
+        if( h >= threshold.load(memory_order_relaxed) ) return;
+        double scale = 1 / rate();
+        auto it = samples.find(key);
+        if( it == samples.end() ){
+            beyond += scale;
+            const T& sampled = samples.emplace(ownedKey(key), Sample{takeSlot(), h}).first->first;
+            byHash.emplace_back(h, sampled);
+            push_heap(byHash.begin(), byHash.end(), hashLess);
+            if( samples.size() > maxSamples ){
+                shrinkSample();
+            }
+            return;
+        }
+        double distance = (samples.size() - marksUpTo(it->second.slot)) * scale;
+        if( distance < maxCapacity ){
+            histogram[static_cast<size_t>(distance) / binWidth] += scale;
+        } else {
+            beyond += scale;
+        }
+        // Taking a slot may renumber every slot, this key's included
+        uint32_t slot = takeSlot();
+        mark(it->second.slot, -1);
+        it->second.slot = slot;
+    }
+
+public:
+    MissRatioCurveSampler(size_t _maxCapacity, size_t bins = 100, size_t _maxSamples = 8192)
+        : maxCapacity(max<size_t>(_maxCapacity, 1)), maxSamples(max<size_t>(_maxSamples, 1)){
+        binWidth = max<size_t>(1, (maxCapacity + bins - 1) / max<size_t>(bins, 1));
+        histogram.assign((maxCapacity + binWidth - 1) / binWidth, 0);
+        samples.reserve(maxSamples + 1);
+        byHash.reserve(maxSamples + 1);
+        marks.assign(2 * maxSamples + 3, 0);
+    }
+
+    // One reference to the key, e.g. a cache lookup
+    void record(const T& key){
+        recordHashed(key, mix(hasher(key)));
+    }
+
+    // Reuses the caller's hash; the key is copied into a T only if it joins the sample
+    void record(const HashedKey<T>& key){
+        recordHashed(key, mix(key.hash));
+    }
+
+    // Estimated LRU miss ratio with room for `capacity` entries (rounded down to a bin boundary)
+    double missRatio(size_t capacity) const{
+        lock_guard<mutex> guard(lock);
+        return missRatioFromBin(min(capacity / binWidth, histogram.size()));
+    }
+
+    // One point per bin boundary, from binWidth to maxCapacity entries
+    vector<MissRatioPoint> curve() const{
+        lock_guard<mutex> guard(lock);
+        vector<MissRatioPoint> points;
+        for( size_t b = 1; b <= histogram.size(); b++ ){
+            points.push_back({min(b * binWidth, maxCapacity), missRatioFromBin(b)});
+        }
+        return points;
+    }
+
+    // Smallest capacity on the curve whose estimated miss ratio is at most the target
+    optional<size_t> capacityFor(double targetMissRatio) const{
+        for( const MissRatioPoint& point : curve() ){
+            if( point.missRatio <= targetMissRatio ){
+                return point.capacity;
+            }
+        }
+        return nullopt;
+    }
+
+    double samplingRate() const{
+        return rate();
+    }
+
+    size_t sampledKeys() const{
+        lock_guard<mutex> guard(lock);
+        return samples.size();
+    }
+};
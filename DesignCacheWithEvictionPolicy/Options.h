@@ -0,0 +1,48 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+
+using namespace std;
+
+// Command line options of the form --name value
+class Options{
+private:
+    map<string, string> values;
+
+public:
+    Options(int argc, char** argv, int first){
+        for( int i = first; i < argc; i++ ){
+            string name = argv[i];
+            if( name.rfind("--", 0) != 0 || i + 1 == argc ){
+                throw invalid_argument("Expected --option value, got " + name);
+            }
+            values[name.substr(2)] = argv[++i];
+        }
+    }
+
+    string get(const string& name, const string& fallback) const{
+        auto it = values.find(name);
+        return it == values.end() ? fallback : it->second;
+    }
+
+    size_t getSize(const string& name, size_t fallback) const{
+        auto it = values.find(name);
+        return it == values.end() ? fallback : stoull(it->second);
+    }
+
+    double getDouble(const string& name, double fallback) const{
+        auto it = values.find(name);
+        return it == values.end() ? fallback : stod(it->second);
+    }
+};
+
+inline vector<string> splitList(const string& text){
+    vector<string> items;
+    stringstream in(text);
+    string item;
+    while( getline(in, item, ',') ){
+        if( !item.empty() ) items.push_back(item);
+    }
+    return items;
+}
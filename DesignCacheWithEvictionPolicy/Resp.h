@@ -0,0 +1,302 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace std::chrono;
+
+// The subset of RESP (the Redis protocol) spoken by Server: requests are arrays of bulk
+// strings, or inline commands (words separated by spaces, one command per line) for telnet.
+struct RespLimits{
+    static constexpr size_t maxArguments = 1 << 20;
+    static constexpr size_t maxBulkBytes = 64 << 20;
+    static constexpr size_t maxInlineBytes = 64 << 10;
+};
+
+enum class RespParse{ Complete, Incomplete, Error };
+
+// Reads an integer ended by \r\n at `pos`, moving `pos` past the \r\n
+inline RespParse parseRespInteger(string_view input, size_t& pos, int64_t& value){
+    size_t end = input.find('\r', pos);
+    if( end == string_view::npos || end + 1 >= input.size() ){
+        return end == string_view::npos && input.size() - pos > 20 ? RespParse::Error : RespParse::Incomplete;
+    }
+    auto [last, error] = from_chars(input.data() + pos, input.data() + end, value);
+    if( error != errc() || last != input.data() + end || input[end + 1] != '\n' ){
+        return RespParse::Error;
+    }
+    pos = end + 2;
+    return RespParse::Complete;
+}
+
+// Parses the request at the front of `input`. On Complete, `args` point into `input` (nothing
+// is copied) and `consumed` is the request's length; on Error, `error` says what was wrong.
+inline RespParse parseRespCommand(string_view input, vector<string_view>& args, size_t& consumed, string& error){
+    args.clear();
+    if( input.empty() ) return RespParse::Incomplete;
+    if( input[0] != '*' ){
+        size_t end = input.find('\n');
+        if( end == string_view::npos ){
+            if( input.size() <= RespLimits::maxInlineBytes ) return RespParse::Incomplete;
+            error = "inline request too long";
+            return RespParse::Error;
+        }
+        string_view line = input.substr(0, end);
+        if( !line.empty() && line.back() == '\r' ) line.remove_suffix(1);
+        size_t pos = 0;
+        while( pos < line.size() ){
+            size_t space = line.find(' ', pos);
+            if( space == string_view::npos ) space = line.size();
+            if( space > pos ) args.push_back(line.substr(pos, space - pos));
+            pos = space + 1;
+        }
+        consumed = end + 1;
+        return RespParse::Complete;
+    }
+
+    size_t pos = 1;
+    int64_t count;
+    RespParse state = parseRespInteger(input, pos, count);
+    if( state != RespParse::Complete ){
+        error = "invalid multibulk length";
+        return state;
+    }
+    if( count < 0 || static_cast<size_t>(count) > RespLimits::maxArguments ){
+        error = "invalid multibulk length";
+        return RespParse::Error;
+    }
+    for( int64_t i = 0; i < count; i++ ){
+        if( pos >= input.size() ) return RespParse::Incomplete;
+        if( input[pos] != '$' ){
+            error = "expected '$', got '" + string(1, input[pos]) + "'";
+            return RespParse::Error;
+        }
+        pos++;
+        int64_t length;
+        state = parseRespInteger(input, pos, length);
+        if( state != RespParse::Complete ){
+            error = "invalid bulk length";
+            return state;
+        }
+        if( length < 0 || static_cast<size_t>(length) > RespLimits::maxBulkBytes ){
+            error = "invalid bulk length";
+            return RespParse::Error;
+        }
+        if( input.size() - pos < static_cast<size_t>(length) + 2 ) return RespParse::Incomplete;
+        if( input[pos + length] != '\r' || input[pos + length + 1] != '\n' ){
+            error = "bulk string not ended by CRLF";
+            return RespParse::Error;
+        }
+        args.push_back(input.substr(pos, length));
+        pos += length + 2;
+    }
+    consumed = pos;
+    return RespParse::Complete;
+}
+
+// Length of the complete reply at the front of `input`, or nullopt if more bytes are needed.
+// Used by clients; throws on a malformed reply.
+inline optional<size_t> respReplyLength(string_view input, size_t pos = 0){
+    if( pos >= input.size() ) return nullopt;
+    char type = input[pos];
+    size_t lineEnd = input.find("\r\n", pos);
+    if( lineEnd == string_view::npos ) return nullopt;
+    if( type == '+' || type == '-' || type == ':' ){
+        return lineEnd + 2 - pos;
+    }
+    int64_t count;
+    size_t next = pos + 1;
+    if( parseRespInteger(input, next, count) != RespParse::Complete ){
+        throw runtime_error("Malformed RESP reply");
+    }
+    if( type == '$' ){
+        if( count < 0 ) return next - pos;
+        if( input.size() - next < static_cast<size_t>(count) + 2 ) return nullopt;
+        return next + count + 2 - pos;
+    }
+    if( type == '*' ){
+        for( int64_t i = 0; i < count; i++ ){
+            optional<size_t> element = respReplyLength(input, next);
+            if( !element ) return nullopt;
+            next += *element;
+        }
+        return next - pos;
+    }
+    throw runtime_error("Malformed RESP reply");
+}
+
+// Bytes received on one connection and not yet parsed. read() goes straight into spare
+// capacity, which is never zero-filled; consuming a request only advances `start`, and the
+// unread tail moves to the front when the space behind it runs out.
+class RespInput{
+private:
+    unique_ptr<char[]> buffer;
+    size_t capacity = 0;
+    size_t start = 0;
+    size_t end = 0;
+
+public:
+    string_view unread() const{
+        return string_view(buffer.get() + start, end - start);
+    }
+
+    void consume(size_t bytes){
+        start += bytes;
+        if( start == end ){
+            start = end = 0;
+        }
+    }
+
+    // At least `bytes` of space after the unread bytes; commit() what was written into it
+    span<char> spare(size_t bytes){
+        if( capacity - end < bytes ){
+            size_t unreadBytes = end - start;
+            if( capacity - unreadBytes >= bytes ){
+                memmove(buffer.get(), buffer.get() + start, unreadBytes);
+            } else {
+                size_t grown = max(capacity * 2, unreadBytes + bytes);
+                unique_ptr<char[]> bigger = make_unique_for_overwrite<char[]>(grown);
+                if( unreadBytes ){
+                    memcpy(bigger.get(), buffer.get() + start, unreadBytes);
+                }
+                buffer = move(bigger);
+                capacity = grown;
+            }
+            start = 0;
+            end = unreadBytes;
+        }
+        return span<char>(buffer.get() + end, capacity - end);
+    }
+
+    void commit(size_t bytes){
+        end += bytes;
+    }
+};
+
+// Replies queued for one connection and written with writev. Small pieces are appended to a
+// shared scratch chunk; bulk values of at least zeroCopyBytes are moved in as chunks of their
+// own, so a large value is never copied between the cache and the socket.
+class RespOutput{
+private:
+    static constexpr size_t zeroCopyBytes = 512;
+    static constexpr size_t maxIovecs = 64;
+
+    deque<string> chunks;
+    size_t frontOffset = 0;
+    bool backIsScratch = false;
+    size_t pending = 0;
+
+    string& scratch(){
+        if( !backIsScratch ){
+            chunks.emplace_back();
+            backIsScratch = true;
+        }
+        return chunks.back();
+    }
+
+    void append(string_view text){
+        scratch().append(text);
+        pending += text.size();
+    }
+
+    void appendLine(char type, int64_t value){
+        char line[24];
+        line[0] = type;
+        char* end = to_chars(line + 1, line + sizeof(line) - 2, value).ptr;
+        *end++ = '\r';
+        *end++ = '\n';
+        append(string_view(line, end - line));
+    }
+
+public:
+    void simple(string_view text){
+        append("+");
+        append(text);
+        append("\r\n");
+    }
+
+    // `message` starts with an error code, e.g. "ERR unknown command"
+    void error(string_view message){
+        append("-");
+        append(message);
+        append("\r\n");
+    }
+
+    void integer(int64_t value){
+        appendLine(':', value);
+    }
+
+    void nil(){
+        append("$-1\r\n");
+    }
+
+    void arrayHeader(size_t count){
+        appendLine('*', static_cast<int64_t>(count));
+    }
+
+    void bulk(string&& value){
+        appendLine('$', static_cast<int64_t>(value.size()));
+        if( value.size() >= zeroCopyBytes ){
+            pending += value.size();
+            chunks.push_back(move(value));
+            backIsScratch = false;
+        } else {
+            append(value);
+        }
+        append("\r\n");
+    }
+
+    void bulk(string_view value){
+        appendLine('$', static_cast<int64_t>(value.size()));
+        append(value);
+        append("\r\n");
+    }
+
+    size_t pendingBytes() const{
+        return pending;
+    }
+
+    // Writes with writev until everything is sent or the socket is full. Returns false if the
+    // connection failed.
+    bool flush(int fd){
+        while( pending > 0 ){
+            iovec vectors[maxIovecs];
+            size_t count = 0;
+            size_t batch = 0;
+            for( auto it = chunks.begin(); it != chunks.end() && count < maxIovecs; ++it, ++count ){
+                size_t skip = count == 0 ? frontOffset : 0;
+                vectors[count].iov_base = it->data() + skip;
+                vectors[count].iov_len = it->size() - skip;
+                batch += vectors[count].iov_len;
+            }
+            ssize_t written = writev(fd, vectors, static_cast<int>(count));
+            if( written < 0 ){
+                if( errno == EINTR ) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            pending -= written;
+            size_t left = written;
+            while( left > 0 ){
+                size_t frontLeft = chunks.front().size() - frontOffset;
+                if( left < frontLeft ){
+                    frontOffset += left;
+                    break;
+                }
+                left -= frontLeft;
+                chunks.pop_front();
+                frontOffset = 0;
+            }
+            if( chunks.empty() ){
+                backIsScratch = false;
+            }
+            if( static_cast<size_t>(written) < batch ){
+                return true;   // the socket buffer is full
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,75 @@
+#include <bits/stdc++.h>
+
+#include <csignal>
+
+#include "Options.h"
+#include "Server.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+CacheServer* runningServer = nullptr;
+
+void onSignal(int){
+    if( runningServer ) runningServer->stop();
+}
+
+void printUsage(){
+    cout << "Usage: Server [--port N] [--unix PATH] [--threads N] [--shards N] [--capacity N]\n"
+         << "              [--max-bytes N] [--policy lru|clock|tinylfu|arc|2q|adaptive] [--default-ttl-ms N]\n"
+         << "  Serves GET, SET key value [EX s|PX ms], DEL, MGET, PING and INFO over RESP.\n"
+         << "  --port defaults to 6380 on 127.0.0.1 (0 disables TCP); --unix adds a Unix socket.\n"
+         << "  --max-bytes bounds keys plus values instead of the entry count.\n"
+         << "  --default-ttl-ms applies to SET without EX/PX; 0 means entries never expire.\n";
+}
+
+int main(int argc, char** argv){
+    try{
+        Options options(argc, argv, 1);
+        uint16_t port = static_cast<uint16_t>(options.getSize("port", 6380));
+        string unixPath = options.get("unix", "");
+        size_t threads = options.getSize("threads", 1);
+        size_t shards = options.getSize("shards", 16);
+        size_t capacity = options.getSize("capacity", 1000000);
+        size_t maxBytes = options.getSize("max-bytes", 0);
+        string policy = options.get("policy", "lru");
+        milliseconds defaultTtl(options.getSize("default-ttl-ms", 0));
+        if( defaultTtl.count() == 0 ){
+            defaultTtl = duration_cast<milliseconds>(hours(24 * 365 * 100));
+        }
+
+        auto storageFactory = [&]{ return make_unique<TTLHashMapStorage<string, string>>(defaultTtl); };
+        auto policyFactory = [&]{ return makeEvictionPolicy<string>(policy, capacity / shards + 1); };
+        unique_ptr<CacheServer::Store> cache;
+        if( maxBytes ){
+            auto weigher = [](const string& key, const string& val){ return key.size() + val.size(); };
+            cache = make_unique<CacheServer::Store>(shards, maxBytes, weigher, storageFactory, policyFactory);
+        } else {
+            cache = make_unique<CacheServer::Store>(shards, capacity, storageFactory, policyFactory);
+        }
+
+        CacheServer server(*cache, threads);
+        if( port ) server.listenTcp(port);
+        if( !unixPath.empty() ) server.listenUnix(unixPath);
+
+        runningServer = &server;
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        cout << "Serving";
+        if( port ) cout << " 127.0.0.1:" << port;
+        if( !unixPath.empty() ) cout << " " << unixPath;
+        cout << " with " << threads << " event loop(s)" << endl;
+        server.run();
+        runningServer = nullptr;
+    } catch( const invalid_argument& e ){
+        cerr << e.what() << "\n";
+        printUsage();
+        return 1;
+    } catch( const exception& e ){
+        cerr << "Server failed: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
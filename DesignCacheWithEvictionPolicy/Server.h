@@ -0,0 +1,356 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Cache.h"
+#include "Resp.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Serves a ShardedCache<string, string> over RESP on loopback TCP and Unix sockets, so several
+// local processes can share one cache. Commands: GET, SET key value [EX seconds | PX ms], DEL,
+// MGET, PING, INFO (the metrics text export) and QUIT.
+// Each event loop is one thread with its own epoll set; every loop waits on every listener
+// (EPOLLEXCLUSIVE, so a new connection wakes one loop) and keeps the connections it accepts.
+// A read parses every complete request in the buffer and answers them all with one writev,
+// so pipelined requests cost one system call per batch in each direction.
+class CacheServer{
+public:
+    using Store = ShardedCache<string, string>;
+
+private:
+    static constexpr size_t readBytes = 64 << 10;
+    // A connection whose replies pile up past this is not read again until they drain
+    static constexpr size_t maxPendingOutput = 4 << 20;
+    static constexpr int maxEvents = 256;
+
+    struct Connection{
+        int fd;
+        RespInput input;
+        RespOutput output;
+        bool closing = false;
+        uint32_t interest = 0;
+    };
+
+    struct Listener{
+        int fd;
+        bool tcp;
+    };
+
+    Store& cache;
+    vector<Listener> listeners;
+    vector<int> wakeFds;
+    string unixPath;
+
+    [[noreturn]] static void fail(const string& what){
+        throw system_error(errno, generic_category(), what);
+    }
+
+    static bool isCommand(string_view arg, string_view upper){
+        return arg.size() == upper.size() && equal(arg.begin(), arg.end(), upper.begin(), [](char a, char b){ return toupper(static_cast<unsigned char>(a)) == b; });
+    }
+
+    static optional<int64_t> parseInteger(string_view text){
+        int64_t value;
+        auto [last, error] = from_chars(text.data(), text.data() + text.size(), value);
+        if( error != errc() || last != text.data() + text.size() ) return nullopt;
+        return value;
+    }
+
+    void addListener(int fd, bool tcp){
+        if( listen(fd, SOMAXCONN) != 0 ) fail("listen");
+        listeners.push_back({fd, tcp});
+    }
+
+    void execute(const vector<string_view>& args, Connection& connection){
+        RespOutput& out = connection.output;
+        if( args.empty() ) return;
+        string_view command = args[0];
+        if( isCommand(command, "GET") && args.size() == 2 ){
+            // Looked up by view into the input buffer: no key string is built
+            if( optional<string> val = cache.tryGet(HashedKey<string>(args[1])) ){
+                out.bulk(move(*val));
+            } else {
+                out.nil();
+            }
+        } else if( isCommand(command, "SET") && (args.size() == 3 || args.size() == 5) ){
+            bool stored;
+            if( args.size() == 5 ){
+                optional<int64_t> amount = parseInteger(args[4]);
+                bool seconds = isCommand(args[3], "EX");
+                if( !seconds && !isCommand(args[3], "PX") ){
+                    out.error("ERR syntax error");
+                    return;
+                }
+                if( !amount ){
+                    out.error("ERR value is not an integer or out of range");
+                    return;
+                }
+                if( *amount <= 0 ){
+                    out.error("ERR invalid expire time in 'set' command");
+                    return;
+                }
+                milliseconds ttl(seconds ? *amount * 1000 : *amount);
+                stored = cache.put(string(args[1]), string(args[2]), ttl);
+            } else {
+                stored = cache.put(string(args[1]), string(args[2]));
+            }
+            if( stored ){
+                out.simple("OK");
+            } else {
+                out.error("ERR value too large for the cache");
+            }
+        } else if( isCommand(command, "DEL") && args.size() >= 2 ){
+            int64_t removed = 0;
+            for( size_t i = 1; i < args.size(); i++ ){
+                removed += cache.remove(string(args[i]));
+            }
+            out.integer(removed);
+        } else if( isCommand(command, "MGET") && args.size() >= 2 ){
+            vector<string> keys(args.begin() + 1, args.end());
+            vector<optional<string>> values = cache.multiGet(keys);
+            out.arrayHeader(values.size());
+            for( optional<string>& val : values ){
+                if( val ){
+                    out.bulk(move(*val));
+                } else {
+                    out.nil();
+                }
+            }
+        } else if( isCommand(command, "PING") && args.size() <= 2 ){
+            if( args.size() == 2 ){
+                out.bulk(args[1]);
+            } else {
+                out.simple("PONG");
+            }
+        } else if( isCommand(command, "INFO") ){
+            out.bulk(formatStats(cache.stats()));
+        } else if( isCommand(command, "QUIT") ){
+            out.simple("OK");
+            connection.closing = true;
+        } else if( isCommand(command, "COMMAND") ){
+            // Sent by redis-cli on connect; an empty list just disables its hints
+            out.arrayHeader(0);
+        } else {
+            out.error("ERR unknown command or wrong number of arguments for '" + string(command) + "'");
+        }
+    }
+
+    // Runs every complete request in the input buffer and drops it from the buffer
+    void handleRequests(Connection& connection){
+        vector<string_view> args;
+        string error;
+        size_t offset = 0;
+        while( !connection.closing ){
+            size_t consumed = 0;
+            RespParse state = parseRespCommand(connection.input.unread().substr(offset), args, consumed, error);
+            if( state == RespParse::Incomplete ) break;
+            if( state == RespParse::Error ){
+                connection.output.error("ERR Protocol error: " + error);
+                connection.closing = true;
+                break;
+            }
+            try{
+                execute(args, connection);
+            } catch( const exception& e ){
+                connection.output.error(string("ERR ") + e.what());
+            }
+            offset += consumed;
+        }
+        connection.input.consume(offset);
+    }
+
+    void updateInterest(int epoll, Connection& connection){
+        uint32_t interest = 0;
+        if( !connection.closing && connection.output.pendingBytes() < maxPendingOutput ) interest |= EPOLLIN;
+        if( connection.output.pendingBytes() > 0 ) interest |= EPOLLOUT;
+        if( interest != connection.interest ){
+            epoll_event event{};
+            event.events = interest;
+            event.data.fd = connection.fd;
+            epoll_ctl(epoll, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.interest = interest;
+        }
+    }
+
+    // Returns false once the connection should be closed
+    bool readFrom(Connection& connection){
+        span<char> room = connection.input.spare(readBytes);
+        ssize_t got = read(connection.fd, room.data(), room.size());
+        if( got == 0 ) return false;
+        if( got < 0 ) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        connection.input.commit(got);
+        handleRequests(connection);
+        return true;
+    }
+
+    void acceptFrom(int epoll, const Listener& listener, unordered_map<int, unique_ptr<Connection>>& connections){
+        while( true ){
+            int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if( fd < 0 ) return;   // EAGAIN: no more pending, or another loop took it
+            if( listener.tcp ){
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            auto connection = make_unique<Connection>();
+            connection->fd = fd;
+            connection->interest = EPOLLIN;
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+            connections[fd] = move(connection);
+        }
+    }
+
+    void serve(size_t loop){
+        int epoll = epoll_create1(EPOLL_CLOEXEC);
+        if( epoll < 0 ) fail("epoll_create1");
+        unordered_map<int, unique_ptr<Connection>> connections;
+        for( const Listener& listener : listeners ){
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLEXCLUSIVE;
+            event.data.fd = listener.fd;
+            epoll_ctl(epoll, EPOLL_CTL_ADD, listener.fd, &event);
+        }
+        epoll_event wake{};
+        wake.events = EPOLLIN;
+        wake.data.fd = wakeFds[loop];
+        epoll_ctl(epoll, EPOLL_CTL_ADD, wakeFds[loop], &wake);
+
+        epoll_event events[maxEvents];
+        bool running = true;
+        while( running ){
+            int ready = epoll_wait(epoll, events, maxEvents, -1);
+            if( ready < 0 && errno != EINTR ) fail("epoll_wait");
+            for( int i = 0; i < ready; i++ ){
+                int fd = events[i].data.fd;
+                if( fd == wakeFds[loop] ){
+                    running = false;
+                    continue;
+                }
+                auto listener = find_if(listeners.begin(), listeners.end(), [&](const Listener& l){ return l.fd == fd; });
+                if( listener != listeners.end() ){
+                    acceptFrom(epoll, *listener, connections);
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if( it == connections.end() ) continue;
+                Connection& connection = *it->second;
+                bool open = true;
+                if( events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) ){
+                    open = readFrom(connection);
+                }
+                if( open ){
+                    open = connection.output.flush(fd) && !(connection.closing && connection.output.pendingBytes() == 0);
+                }
+                if( !open ){
+                    close(fd);
+                    connections.erase(it);
+                    continue;
+                }
+                updateInterest(epoll, connection);
+            }
+        }
+        for( auto& [fd, connection] : connections ){
+            close(fd);
+        }
+        close(epoll);
+    }
+
+public:
+    // `loops` event loop threads share the cache
+    CacheServer(Store& _cache, size_t loops = 1) : cache(_cache){
+        for( size_t i = 0; i < max<size_t>(loops, 1); i++ ){
+            int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if( fd < 0 ) fail("eventfd");
+            wakeFds.push_back(fd);
+        }
+    }
+
+    CacheServer(const CacheServer&) = delete;
+    CacheServer& operator=(const CacheServer&) = delete;
+
+    ~CacheServer(){
+        for( const Listener& listener : listeners ){
+            close(listener.fd);
+        }
+        for( int fd : wakeFds ){
+            close(fd);
+        }
+        if( !unixPath.empty() ){
+            unlink(unixPath.c_str());
+        }
+    }
+
+    // Binds 127.0.0.1 only: the server is meant for processes on the same host
+    void listenTcp(uint16_t port){
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if( fd < 0 ) fail("socket");
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if( bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ){
+            close(fd);
+            fail("bind 127.0.0.1:" + to_string(port));
+        }
+        addListener(fd, true);
+    }
+
+    // Replaces a stale socket file left at `path`; the file is removed with the server
+    void listenUnix(const string& path){
+        sockaddr_un address{};
+        if( path.size() >= sizeof(address.sun_path) ){
+            throw invalid_argument("Unix socket path too long: " + path);
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if( fd < 0 ) fail("socket");
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        if( bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ){
+            close(fd);
+            fail("bind " + path);
+        }
+        unixPath = path;
+        addListener(fd, false);
+    }
+
+    // Runs the event loops (the calling thread is one of them) until stop()
+    void run(){
+        if( listeners.empty() ){
+            throw logic_error("The server has nothing to listen on");
+        }
+        vector<thread> loops;
+        for( size_t i = 1; i < wakeFds.size(); i++ ){
+            loops.emplace_back([this, i]{ serve(i); });
+        }
+        serve(0);
+        for( thread& loop : loops ){
+            loop.join();
+        }
+    }
+
+    // Async-signal-safe, so it may be called from a signal handler
+    void stop(){
+        for( int fd : wakeFds ){
+            uint64_t one = 1;
+            ssize_t ignored = write(fd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SpillStorage.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Cache contents in eviction order: entry 0 is the next victim and the last entry the most
+// protected key. frequencies holds the policy's hint for each key (see forEachInEvictionOrder).
+template<typename K, typename V>
+struct CacheSnapshot{
+    vector<K> keys;
+    vector<V> values;
+    vector<uint8_t> frequencies;
+
+    void reserve(size_t entries){
+        keys.reserve(entries);
+        values.reserve(entries);
+        frequencies.reserve(entries);
+    }
+
+    void add(const K& key, const V& val, uint8_t frequency){
+        keys.push_back(key);
+        values.push_back(val);
+        frequencies.push_back(frequency);
+    }
+
+    size_t size() const{
+        return keys.size();
+    }
+
+    const V& value(size_t i) const{
+        return values[i];
+    }
+};
+
+// Snapshot file layout, in the writing host's byte order:
+//   header:  "CSNP", uint32 version, uint32 byte-order mark, uint64 entry count
+//   entries: uint32 key bytes, uint32 value bytes, uint8 frequency, key, value
+// Keys and values are encoded with SpillCodec, which copies trivially copyable types as they
+// are in memory, so the file cannot be byte-swapped on load. A reader on a host of the other
+// byte order sees the mark reversed and rejects the file.
+struct SnapshotFormat{
+    static constexpr char magic[4] = {'C', 'S', 'N', 'P'};
+    static constexpr uint32_t version = 2;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+    static constexpr uint32_t swappedByteOrderMark = 0x04030201;
+    static constexpr size_t entryCountOffset = 12;
+    static constexpr size_t headerBytes = 20;
+    static constexpr size_t recordHeaderBytes = 9;
+};
+
+// Streams snapshots into `path` through a temporary file that replaces it on close(), so a
+// crash mid-write leaves any previous snapshot intact. Several snapshots can be appended, e.g.
+// one per shard.
+class SnapshotWriter{
+private:
+    string path;
+    string tempPath;
+    ofstream out;
+    vector<char> buffer = vector<char>(1 << 20);
+    uint64_t entries = 0;
+    bool closed = false;
+
+    template<typename X>
+    void writeRaw(const X& x){
+        out.write(reinterpret_cast<const char*>(&x), sizeof(X));
+    }
+
+public:
+    SnapshotWriter(const string& _path) : path(_path), tempPath(_path + ".tmp"){
+        out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        out.open(tempPath, ios::binary | ios::trunc);
+        if( !out ){
+            throw runtime_error("Cannot open snapshot file " + tempPath);
+        }
+        out.write(SnapshotFormat::magic, 4);
+        writeRaw(SnapshotFormat::version);
+        writeRaw(SnapshotFormat::byteOrderMark);
+        writeRaw(entries);
+    }
+
+    ~SnapshotWriter(){
+        if( !closed ){
+            out.close();
+            remove(tempPath.c_str());
+        }
+    }
+
+    template<typename K, typename V>
+    void append(const CacheSnapshot<K, V>& snapshot){
+        string scratch;
+        for( size_t i = 0; i < snapshot.size(); i++ ){
+            uint32_t keyBytes = static_cast<uint32_t>(SpillCodec<K>::size(snapshot.keys[i]));
+            uint32_t valueBytes = static_cast<uint32_t>(SpillCodec<V>::size(snapshot.values[i]));
+            writeRaw(keyBytes);
+            writeRaw(valueBytes);
+            writeRaw(snapshot.frequencies[i]);
+            scratch.resize(keyBytes + valueBytes);
+            SpillCodec<K>::write(snapshot.keys[i], scratch.data());
+            SpillCodec<V>::write(snapshot.values[i], scratch.data() + keyBytes);
+            out.write(scratch.data(), scratch.size());
+        }
+        entries += snapshot.size();
+    }
+
+    // Writes the entry count into the header and moves the file into place
+    void close(){
+        out.seekp(SnapshotFormat::entryCountOffset);
+        writeRaw(entries);
+        out.close();
+        if( !out ){
+            throw runtime_error("Failed writing snapshot file " + tempPath);
+        }
+        closed = true;
+        filesystem::rename(tempPath, path);
+    }
+};
+
+template<typename K, typename V>
+void writeSnapshot(const string& path, const CacheSnapshot<K, V>& snapshot){
+    SnapshotWriter writer(path);
+    writer.append(snapshot);
+    writer.close();
+}
+
+// A snapshot file mapped read-only. Keys and frequencies are decoded up front, since the
+// policy rebuilds its order from the whole key list; each value is decoded from the mapping only
+// when asked for, so a restore holds one decoded copy of the values, the one in storage.
+template<typename K, typename V>
+class SnapshotReader{
+private:
+    shared_ptr<const char> mapping;
+    vector<size_t> valueOffsets;
+    vector<uint32_t> valueBytes;
+
+public:
+    vector<K> keys;
+    vector<uint8_t> frequencies;
+
+    SnapshotReader() = default;
+
+    SnapshotReader(const string& path){
+        int fd = open(path.c_str(), O_RDONLY);
+        if( fd < 0 ){
+            throw system_error(errno, generic_category(), "open " + path);
+        }
+        struct stat info{};
+        fstat(fd, &info);
+        size_t bytes = static_cast<size_t>(info.st_size);
+        if( bytes < SnapshotFormat::headerBytes ){
+            close(fd);
+            throw runtime_error("Corrupt snapshot " + path + ": truncated header");
+        }
+        void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if( mapped == MAP_FAILED ){
+            throw system_error(errno, generic_category(), "mmap " + path);
+        }
+        mapping = shared_ptr<const char>(static_cast<const char*>(mapped), [bytes](const char* p){ munmap(const_cast<char*>(p), bytes); });
+        madvise(mapped, bytes, MADV_SEQUENTIAL);
+
+        const char* data = mapping.get();
+        uint32_t version, byteOrder;
+        uint64_t entries;
+        memcpy(&version, data + 4, sizeof(version));
+        memcpy(&byteOrder, data + 8, sizeof(byteOrder));
+        memcpy(&entries, data + SnapshotFormat::entryCountOffset, sizeof(entries));
+        if( memcmp(data, SnapshotFormat::magic, 4) == 0 && byteOrder == SnapshotFormat::swappedByteOrderMark ){
+            throw runtime_error("Snapshot " + path + " was written on a host of the other byte order");
+        }
+        if( memcmp(data, SnapshotFormat::magic, 4) != 0 || version != SnapshotFormat::version || byteOrder != SnapshotFormat::byteOrderMark ){
+            throw runtime_error("Corrupt snapshot " + path + ": bad magic or version");
+        }
+
+        size_t capacity = min<uint64_t>(entries, bytes / SnapshotFormat::recordHeaderBytes);
+        keys.reserve(capacity);
+        frequencies.reserve(capacity);
+        valueOffsets.reserve(capacity);
+        valueBytes.reserve(capacity);
+        size_t offset = SnapshotFormat::headerBytes;
+        for( uint64_t i = 0; i < entries; i++ ){
+            if( bytes - offset < SnapshotFormat::recordHeaderBytes ){
+                throw runtime_error("Corrupt snapshot " + path + ": truncated record");
+            }
+            uint32_t keyLength, valueLength;
+            memcpy(&keyLength, data + offset, 4);
+            memcpy(&valueLength, data + offset + 4, 4);
+            uint8_t frequency = static_cast<uint8_t>(data[offset + 8]);
+            offset += SnapshotFormat::recordHeaderBytes;
+            if( bytes - offset < static_cast<size_t>(keyLength) + valueLength ){
+                throw runtime_error("Corrupt snapshot " + path + ": truncated record");
+            }
+            if( (is_trivially_copyable_v<K> && keyLength != sizeof(K)) || (is_trivially_copyable_v<V> && valueLength != sizeof(V)) ){
+                throw runtime_error("Corrupt snapshot " + path + ": record size does not match the key or value type");
+            }
+            keys.push_back(SpillCodec<K>::read(data + offset, keyLength));
+            frequencies.push_back(frequency);
+            valueOffsets.push_back(offset + keyLength);
+            valueBytes.push_back(valueLength);
+            offset += keyLength + valueLength;
+        }
+    }
+
+    size_t size() const{
+        return keys.size();
+    }
+
+    V value(size_t i) const{
+        return SpillCodec<V>::read(mapping.get() + valueOffsets[i], valueBytes[i]);
+    }
+
+    // Moves the entries into one reader per part, keeping their relative order. The parts share
+    // this reader's mapping; this reader is left empty.
+    vector<SnapshotReader> split(size_t parts, const function<size_t(const K&)>& partOf){
+        vector<SnapshotReader> result(parts);
+        for( auto& part : result ){
+            part.mapping = mapping;
+        }
+        for( size_t i = 0; i < size(); i++ ){
+            SnapshotReader& part = result[partOf(keys[i])];
+            part.keys.push_back(move(keys[i]));
+            part.frequencies.push_back(frequencies[i]);
+            part.valueOffsets.push_back(valueOffsets[i]);
+            part.valueBytes.push_back(valueBytes[i]);
+        }
+        keys.clear();
+        frequencies.clear();
+        valueOffsets.clear();
+        valueBytes.clear();
+        return result;
+    }
+};
+
+// Decodes the whole file, values included, into memory
+template<typename K, typename V>
+CacheSnapshot<K, V> readSnapshot(const string& path){
+    SnapshotReader<K, V> reader(path);
+    CacheSnapshot<K, V> snapshot;
+    snapshot.values.reserve(reader.size());
+    for( size_t i = 0; i < reader.size(); i++ ){
+        snapshot.values.push_back(reader.value(i));
+    }
+    snapshot.keys = move(reader.keys);
+    snapshot.frequencies = move(reader.frequencies);
+    return snapshot;
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Storage.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Byte encoding of keys and values written to disk: size(x) bytes written by write(x, out)
+// and decoded by read(in, size)
+template<typename X>
+struct SpillCodec;
+
+template<typename X>
+    requires is_trivially_copyable_v<X>
+struct SpillCodec<X>{
+    static size_t size(const X&){
+        return sizeof(X);
+    }
+
+    static void write(const X& x, char* out){
+        memcpy(out, &x, sizeof(X));
+    }
+
+    static X read(const char* in, size_t){
+        X x;
+        memcpy(&x, in, sizeof(X));
+        return x;
+    }
+};
+
+template<>
+struct SpillCodec<string>{
+    static size_t size(const string& s){
+        return s.size();
+    }
+
+    static void write(const string& s, char* out){
+        memcpy(out, s.data(), s.size());
+    }
+
+    static string read(const char* in, size_t bytes){
+        return string(in, bytes);
+    }
+};
+
+// Disk usage of an MmapStorage. Write amplification is the bytes written to segment files
+// (appends plus compaction copies) per byte of record the user wrote.
+struct SpillStats{
+    size_t liveBytes = 0;
+    size_t diskBytes = 0;
+    size_t userBytes = 0;
+    size_t compactionBytes = 0;
+    size_t segments = 0;
+
+    double writeAmplification() const{
+        return userBytes ? static_cast<double>(userBytes + compactionBytes) / userBytes : 0;
+    }
+};
+
+// Storage that keeps only an index (key -> segment, offset, length) in memory and the records
+// in append-only segment files mapped with mmap. Overwrites and removes leave dead records
+// behind; once a sealed segment's live fraction drops below compactBelow, a background thread
+// copies its live records to the active segment and deletes the file. The files are scratch
+// space: they are deleted with the storage, so the directory should not be shared.
+// find() decodes into a buffer owned by the storage, valid until the next call on it.
+template<typename T, typename V>
+class MmapStorage : public IStorage<T, V>{
+private:
+    using KeyCodec = SpillCodec<T>;
+    using ValueCodec = SpillCodec<V>;
+
+    struct RecordHeader{
+        uint32_t keyBytes;
+        uint32_t valueBytes;
+    };
+
+    struct Location{
+        uint32_t segment;
+        uint32_t offset;
+        uint32_t bytes;
+    };
+
+    struct Segment{
+        uint32_t id;
+        string path;
+        int fd = -1;
+        char* base = nullptr;
+        size_t capacity = 0;
+        size_t used = 0;
+        size_t liveBytes = 0;
+
+        ~Segment(){
+            if( base ) munmap(base, capacity);
+            if( fd >= 0 ) close(fd);
+            unlink(path.c_str());
+        }
+    };
+
+    static constexpr uint32_t noSegment = UINT32_MAX;
+
+    filesystem::path directory;
+    size_t segmentBytes;
+    double compactBelow;
+    unordered_map<T, Location> index;
+    map<uint32_t, unique_ptr<Segment>> segments;
+    Segment* active = nullptr;
+    uint32_t nextSegmentId = 0;
+    uint32_t compacting = noSegment;
+    size_t userBytes = 0;
+    size_t compactionBytes = 0;
+    V lastRead{};
+
+    // Guards everything above; foreground calls and the compactor take turns
+    mutable mutex lock;
+    condition_variable compactorWake;
+    condition_variable compactorIdle;
+    bool stopping = false;
+    thread compactor;
+
+    static size_t recordSize(size_t keyBytes, size_t valueBytes){
+        return (sizeof(RecordHeader) + keyBytes + valueBytes + 7) / 8 * 8;
+    }
+
+    [[noreturn]] static void fail(const string& what, const string& path){
+        throw system_error(errno, generic_category(), what + " " + path);
+    }
+
+    Segment& openSegment(size_t minBytes){
+        auto segment = make_unique<Segment>();
+        segment->id = nextSegmentId++;
+        segment->path = (directory / ("segment-" + to_string(segment->id) + ".dat")).string();
+        segment->capacity = max(segmentBytes, minBytes);
+        segment->fd = open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if( segment->fd < 0 ) fail("open", segment->path);
+        if( ftruncate(segment->fd, segment->capacity) != 0 ) fail("ftruncate", segment->path);
+        void* base = mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+        if( base == MAP_FAILED ) fail("mmap", segment->path);
+        segment->base = static_cast<char*>(base);
+        Segment& opened = *segment;
+        segments.emplace(opened.id, move(segment));
+        return opened;
+    }
+
+    // Room for `bytes` at the end of the active segment, sealing it and opening a new one if full
+    Location allocate(size_t bytes){
+        if( !active || active->used + bytes > active->capacity ){
+            Segment* sealed = active;
+            active = &openSegment(bytes);
+            if( sealed && sealed->liveBytes == 0 ){
+                segments.erase(sealed->id);
+            } else if( sealed ){
+                compactorWake.notify_one();
+            }
+        }
+        Location location{active->id, static_cast<uint32_t>(active->used), static_cast<uint32_t>(bytes)};
+        active->used += bytes;
+        active->liveBytes += bytes;
+        return location;
+    }
+
+    char* addressOf(const Location& location) const{
+        return segments.at(location.segment)->base + location.offset;
+    }
+
+    // Marks a record dead; a sealed segment left with no live records is deleted at once
+    void release(const Location& location){
+        Segment& segment = *segments.at(location.segment);
+        segment.liveBytes -= location.bytes;
+        if( &segment == active || segment.id == compacting ){
+            return;
+        }
+        if( segment.liveBytes == 0 ){
+            segments.erase(segment.id);
+        } else if( needsCompaction(segment) ){
+            compactorWake.notify_one();
+        }
+    }
+
+    bool needsCompaction(const Segment& segment) const{
+        return &segment != active && segment.liveBytes < compactBelow * segment.used;
+    }
+
+    Segment* compactionCandidate(){
+        for( auto& [id, segment] : segments ){
+            if( needsCompaction(*segment) ){
+                return segment.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // Copies the live records of one sealed segment to the active one. The lock is released
+    // every batch of records, so foreground calls wait for at most one batch.
+    void compact(unique_lock<mutex>& guard, Segment& segment){
+        static constexpr size_t batch = 256;
+        compacting = segment.id;
+        size_t offset = 0;
+        while( offset < segment.used && !stopping ){
+            for( size_t n = 0; n < batch && offset < segment.used; n++ ){
+                const char* record = segment.base + offset;
+                RecordHeader header;
+                memcpy(&header, record, sizeof(header));
+                size_t bytes = recordSize(header.keyBytes, header.valueBytes);
+                auto it = index.find(KeyCodec::read(record + sizeof(header), header.keyBytes));
+                if( it != index.end() && it->second.segment == segment.id && it->second.offset == offset ){
+                    Location moved = allocate(bytes);
+                    memcpy(addressOf(moved), record, bytes);
+                    it->second = moved;
+                    segment.liveBytes -= bytes;
+                    compactionBytes += bytes;
+                }
+                offset += bytes;
+            }
+            guard.unlock();
+            guard.lock();
+        }
+        compacting = noSegment;
+        if( !stopping ){
+            segments.erase(segment.id);
+        }
+    }
+
+    void runCompactor(){
+        unique_lock<mutex> guard(lock);
+        while( true ){
+            compactorIdle.notify_all();
+            compactorWake.wait(guard, [&]{ return stopping || compactionCandidate(); });
+            if( stopping ){
+                return;
+            }
+            compact(guard, *compactionCandidate());
+        }
+    }
+
+public:
+    using IStorage<T, V>::add;
+    using IStorage<T, V>::find;
+
+    MmapStorage(const filesystem::path& _directory, size_t _segmentBytes = 64 << 20, double _compactBelow = 0.5)
+        : directory(_directory), segmentBytes(_segmentBytes), compactBelow(_compactBelow){
+        if( segmentBytes == 0 || segmentBytes > UINT32_MAX ){
+            throw invalid_argument("Segment size must be between 1 byte and 4 GiB");
+        }
+        filesystem::create_directories(directory);
+        compactor = thread([this]{ runCompactor(); });
+    }
+
+    MmapStorage(const MmapStorage&) = delete;
+    MmapStorage& operator=(const MmapStorage&) = delete;
+
+    ~MmapStorage(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        compactorWake.notify_one();
+        compactor.join();
+    }
+
+    void add(const T& key, const V& val) override{
+        size_t keyBytes = KeyCodec::size(key);
+        size_t valueBytes = ValueCodec::size(val);
+        size_t bytes = recordSize(keyBytes, valueBytes);
+        if( bytes > UINT32_MAX ){
+            throw invalid_argument("Record too large for MmapStorage");
+        }
+        lock_guard<mutex> guard(lock);
+        Location location = allocate(bytes);
+        char* record = addressOf(location);
+        RecordHeader header{static_cast<uint32_t>(keyBytes), static_cast<uint32_t>(valueBytes)};
+        memcpy(record, &header, sizeof(header));
+        KeyCodec::write(key, record + sizeof(header));
+        ValueCodec::write(val, record + sizeof(header) + keyBytes);
+        userBytes += bytes;
+
+        auto [it, inserted] = index.try_emplace(key, location);
+        if( !inserted ){
+            Location old = it->second;
+            it->second = location;
+            release(old);
+        }
+    }
+
+    V get(const T& key) override{
+        V* val = find(key);
+        if( !val ){
+            throw runtime_error("Key not found in Mmap Cache");
+        }
+        return *val;
+    }
+
+    V* find(const T& key) override{
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(key);
+        if( it == index.end() ){
+            return nullptr;
+        }
+        const char* record = addressOf(it->second);
+        RecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        lastRead = ValueCodec::read(record + sizeof(header) + header.keyBytes, header.valueBytes);
+        return &lastRead;
+    }
+
+    void remove(const T& key) override{
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(key);
+        if( it != index.end() ){
+            Location old = it->second;
+            index.erase(it);
+            release(old);
+        }
+    }
+
+    bool exists(const T& key) override{
+        lock_guard<mutex> guard(lock);
+        return index.count(key) > 0;
+    }
+
+    size_t size() const override{
+        lock_guard<mutex> guard(lock);
+        return index.size();
+    }
+
+    void reserve(size_t entries) override{
+        lock_guard<mutex> guard(lock);
+        index.reserve(entries);
+    }
+
+    // Blocks until no sealed segment is waiting for compaction
+    void waitForCompaction(){
+        unique_lock<mutex> guard(lock);
+        compactorIdle.wait(guard, [&]{ return compacting == noSegment && !compactionCandidate(); });
+    }
+
+    SpillStats stats() const{
+        lock_guard<mutex> guard(lock);
+        SpillStats stats;
+        for( auto& [id, segment] : segments ){
+            stats.liveBytes += segment->liveBytes;
+            stats.diskBytes += segment->used;
+        }
+        stats.userBytes = userBytes;
+        stats.compactionBytes = compactionBytes;
+        stats.segments = segments.size();
+        return stats;
+    }
+};
@@ -0,0 +1,766 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "HashedKey.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+template<typename T, typename V >
+class IStorage{
+public:
+    virtual void add(const T& key, const V& val) = 0;
+    // Stores the value with its own TTL; storages without expiry keep it indefinitely
+    virtual void add(const T& key, const V& val, milliseconds ttl){
+        add(key, val);
+    }
+    virtual V get(const T& key) = 0;
+    // Returns a pointer to the stored value, or nullptr if the key is absent
+    virtual V* find(const T& key) = 0;
+    // Lookup by view with the caller's hash; storages without a transparent index build a T
+    virtual V* find(const HashedKey<T>& key){
+        return find(T(key.key));
+    }
+    virtual void remove(const T& Key) = 0;
+    virtual bool exists(const T& key) = 0;
+    virtual size_t size() const = 0;
+    // Storages that drop keys on their own (e.g. on expiry) report them through this listener
+    virtual void setExpirationListener(function<void(const T&)> listener){}
+    // True if find() only reads, so several threads may call it at once
+    virtual bool concurrentReads() const{
+        return false;
+    }
+    // Hint that find(key) follows soon, so batched lookups can overlap their memory misses.
+    // Only storages that can locate a key's memory without loading from it (e.g. open
+    // addressing) implement these; a storage that does overrides both.
+    virtual void prefetch(const T& key) const{}
+    virtual void prefetch(const HashedKey<T>& key) const{}
+    // Makes room for `entries` keys in total ahead of a bulk load
+    virtual void reserve(size_t entries){}
+    
+    virtual ~IStorage() = default;
+};
+
+template<typename T, typename V, typename Alloc = allocator<pair<const T, V>>>
+class HashMapStorage : public IStorage<T, V> {
+private:
+    unordered_map<T, V, KeyHash<T>, KeyEqual<T>, typename allocator_traits<Alloc>::template rebind_alloc<pair<const T, V>>> data;
+
+public:
+    using IStorage<T, V>::add;
+
+    HashMapStorage(const Alloc& alloc = Alloc()) : data(0, KeyHash<T>(), KeyEqual<T>(), alloc) {}
+
+    // Sizes the map up front so it never rehashes while the cache stays within capacity
+    HashMapStorage(size_t capacity, const Alloc& alloc = Alloc()) : HashMapStorage(alloc) {
+        data.reserve(capacity + 1);
+    }
+
+    void add(const T& key, const V& val) override{
+        data[key] = val;
+    }
+     V get(const T& key) override{
+        V* val = find(key);
+        if (!val) {
+            throw runtime_error("Key not found in HashMap Cache");
+        }
+        return *val;
+     }
+
+    V* find(const T& key) override{
+        auto it = data.find(key);
+        return it == data.end() ? nullptr : &it->second;
+    }
+
+    V* find(const HashedKey<T>& key) override{
+        auto it = data.find(key);
+        return it == data.end() ? nullptr : &it->second;
+    }
+
+     
+    void remove(const T& key) override{
+        data.erase(key);
+    }
+    
+    bool exists(const T& key) override{
+        return data.find(key) != data.end();
+    }
+     size_t size() const override{
+         return data.size();
+     }
+
+    void reserve(size_t entries) override{
+        data.reserve(entries);
+    }
+
+    bool concurrentReads() const override{
+        return true;
+    }
+};
+
+// Open-addressing storage in the style of Swiss tables: one control byte per slot holds
+// 7 bits of the key's hash (or "empty"), and lookups compare 16 control bytes at once with
+// SSE2, touching slots only on a tag match. Probing is linear from the key's home slot;
+// removal shifts the following entries back instead of leaving tombstones, so lookups never
+// scan past deleted slots. Values up to 32 bytes live inline in the slot array, larger
+// ones behind a pointer. Pointers from find() stay valid until the next add or remove.
+template<typename T, typename V, typename Hash = hash<T>>
+class FlatHashMapStorage : public IStorage<T, V>{
+private:
+    static constexpr size_t groupWidth = 16;
+    static constexpr int8_t emptyTag = -128;
+    static constexpr bool inlineValues = sizeof(V) <= 32 && is_nothrow_move_constructible_v<V>;
+
+    using StoredValue = conditional_t<inlineValues, V, unique_ptr<V>>;
+
+    struct Slot{
+        T key;
+        StoredValue value;
+    };
+
+    // 16 control bytes starting at any slot; the control array repeats its first
+    // groupWidth - 1 bytes after the end so a group never wraps
+    struct Group{
+#if defined(__SSE2__)
+        __m128i tags;
+
+        Group(const int8_t* ctrl) : tags(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))){}
+
+        uint32_t match(int8_t tag) const{
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), tags)));
+        }
+#else
+        const int8_t* tags;
+
+        Group(const int8_t* ctrl) : tags(ctrl){}
+
+        uint32_t match(int8_t tag) const{
+            uint32_t mask = 0;
+            for( size_t i = 0; i < groupWidth; i++ ){
+                mask |= static_cast<uint32_t>(tags[i] == tag) << i;
+            }
+            return mask;
+        }
+#endif
+        uint32_t matchEmpty() const{
+            return match(emptyTag);
+        }
+    };
+
+    Hash hasher;
+    vector<int8_t> ctrl;
+    Slot* slots = nullptr;
+    size_t mask = 0;
+    size_t count = 0;
+
+    static constexpr size_t notFound = SIZE_MAX;
+
+    // Spreads identity hashes (e.g. of integers) over all bits before splitting them
+    static size_t spread(size_t hash){
+        uint64_t h = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    void prefetchHome(size_t h) const{
+        size_t home = h & mask;
+        __builtin_prefetch(&ctrl[home]);
+        __builtin_prefetch(&slots[home]);
+    }
+
+    size_t hashOf(const T& key) const{
+        return spread(hasher(key));
+    }
+
+    static int8_t tagOf(size_t h){
+        return static_cast<int8_t>(h >> (sizeof(size_t) * 8 - 7));
+    }
+
+    size_t capacity() const{
+        return slots ? mask + 1 : 0;
+    }
+
+    // At most 7/8 of the slots are full, so every probe meets an empty slot
+    static size_t maxLoad(size_t slotCount){
+        return slotCount - slotCount / 8;
+    }
+
+    void setTag(size_t i, int8_t tag){
+        ctrl[i] = tag;
+        if( i < groupWidth - 1 ){
+            ctrl[mask + 1 + i] = tag;
+        }
+    }
+
+    static V& valueOf(Slot& slot){
+        if constexpr( inlineValues ){
+            return slot.value;
+        } else {
+            return *slot.value;
+        }
+    }
+
+    size_t findIndex(LookupKey<T> key, size_t h) const{
+        int8_t tag = tagOf(h);
+        size_t pos = h & mask;
+        while( true ){
+            Group group(&ctrl[pos]);
+            for( uint32_t matches = group.match(tag); matches; matches &= matches - 1 ){
+                size_t i = (pos + countr_zero(matches)) & mask;
+                if( slots[i].key == key ){
+                    return i;
+                }
+            }
+            if( group.matchEmpty() ){
+                return notFound;
+            }
+            pos = (pos + groupWidth) & mask;
+        }
+    }
+
+    size_t findEmpty(size_t h) const{
+        size_t pos = h & mask;
+        while( true ){
+            uint32_t empties = Group(&ctrl[pos]).matchEmpty();
+            if( empties ){
+                return (pos + countr_zero(empties)) & mask;
+            }
+            pos = (pos + groupWidth) & mask;
+        }
+    }
+
+    void destroyAll(){
+        if( !slots ) return;
+        for( size_t i = 0; i <= mask; i++ ){
+            if( ctrl[i] != emptyTag ){
+                destroy_at(&slots[i]);
+            }
+        }
+        allocator<Slot>().deallocate(slots, mask + 1);
+        slots = nullptr;
+    }
+
+    void rehash(size_t slotCount){
+        vector<int8_t> oldCtrl = move(ctrl);
+        Slot* oldSlots = slots;
+        size_t oldCapacity = capacity();
+
+        slots = allocator<Slot>().allocate(slotCount);
+        mask = slotCount - 1;
+        ctrl.assign(slotCount + groupWidth - 1, emptyTag);
+        for( size_t i = 0; i < oldCapacity; i++ ){
+            if( oldCtrl[i] != emptyTag ){
+                size_t h = hashOf(oldSlots[i].key);
+                size_t target = findEmpty(h);
+                construct_at(&slots[target], move(oldSlots[i]));
+                destroy_at(&oldSlots[i]);
+                setTag(target, tagOf(h));
+            }
+        }
+        if( oldSlots ){
+            allocator<Slot>().deallocate(oldSlots, oldCapacity);
+        }
+    }
+
+    void reserveFor(size_t entries){
+        size_t slotCount = groupWidth;
+        while( maxLoad(slotCount) < entries ){
+            slotCount *= 2;
+        }
+        if( slotCount > capacity() ){
+            rehash(slotCount);
+        }
+    }
+
+    // Backward-shift deletion: each later entry of the probe run moves into the hole
+    // unless that would put it before its home slot
+    void eraseAt(size_t hole){
+        destroy_at(&slots[hole]);
+        for( size_t j = (hole + 1) & mask; ctrl[j] != emptyTag; j = (j + 1) & mask ){
+            size_t home = hashOf(slots[j].key) & mask;
+            if( ((j - home) & mask) >= ((j - hole) & mask) ){
+                construct_at(&slots[hole], move(slots[j]));
+                destroy_at(&slots[j]);
+                setTag(hole, ctrl[j]);
+                hole = j;
+            }
+        }
+        setTag(hole, emptyTag);
+        count--;
+    }
+
+public:
+    using IStorage<T, V>::add;
+
+    FlatHashMapStorage(size_t capacity = 0){
+        reserveFor(capacity + 1);
+    }
+
+    FlatHashMapStorage(FlatHashMapStorage&& other) noexcept : hasher(move(other.hasher)), ctrl(move(other.ctrl)), slots(exchange(other.slots, nullptr)), mask(other.mask), count(exchange(other.count, 0)){}
+
+    FlatHashMapStorage& operator=(FlatHashMapStorage other) noexcept{
+        swap(hasher, other.hasher);
+        swap(ctrl, other.ctrl);
+        swap(slots, other.slots);
+        swap(mask, other.mask);
+        swap(count, other.count);
+        return *this;
+    }
+
+    ~FlatHashMapStorage(){
+        destroyAll();
+    }
+
+    void add(const T& key, const V& val) override{
+        size_t h = hashOf(key);
+        size_t i = findIndex(key, h);
+        if( i != notFound ){
+            valueOf(slots[i]) = val;
+            return;
+        }
+        if( count + 1 > maxLoad(capacity()) ){
+            rehash(capacity() * 2);
+        }
+        i = findEmpty(h);
+        if constexpr( inlineValues ){
+            construct_at(&slots[i], Slot{key, val});
+        } else {
+            construct_at(&slots[i], Slot{key, make_unique<V>(val)});
+        }
+        setTag(i, tagOf(h));
+        count++;
+    }
+
+    V get(const T& key) override{
+        V* val = find(key);
+        if( !val ){
+            throw runtime_error("Key not found in FlatHashMap Cache");
+        }
+        return *val;
+    }
+
+    V* find(const T& key) override{
+        size_t i = findIndex(key, hashOf(key));
+        return i == notFound ? nullptr : &valueOf(slots[i]);
+    }
+
+    // The caller's hash can stand in for Hash only when Hash is std::hash
+    V* find(const HashedKey<T>& key) override{
+        if constexpr( same_as<Hash, hash<T>> ){
+            size_t i = findIndex(key.key, spread(key.hash));
+            return i == notFound ? nullptr : &valueOf(slots[i]);
+        } else {
+            return IStorage<T, V>::find(key);
+        }
+    }
+
+    // The home slot is computed without touching memory, so this is a true prefetch
+    void prefetch(const T& key) const override{
+        prefetchHome(hashOf(key));
+    }
+
+    void prefetch(const HashedKey<T>& key) const override{
+        if constexpr( same_as<Hash, hash<T>> ){
+            prefetchHome(spread(key.hash));
+        } else {
+            prefetch(T(key.key));
+        }
+    }
+
+    void remove(const T& key) override{
+        size_t i = findIndex(key, hashOf(key));
+        if( i != notFound ){
+            eraseAt(i);
+        }
+    }
+
+    bool exists(const T& key) override{
+        return findIndex(key, hashOf(key)) != notFound;
+    }
+
+    size_t size() const override{
+        return count;
+    }
+
+    void reserve(size_t entries) override{
+        reserveFor(entries);
+    }
+
+    bool concurrentReads() const override{
+        return true;
+    }
+};
+
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS buckets, where a bucket on level L spans SLOTS^L ticks.
+// Scheduling and cancelling are O(1), and a timer cascades to a lower level at most LEVELS - 1 times
+// before it fires, so expiring an entry costs amortized O(1). Cascades share advance()'s budget,
+// so a tick whose upper-level slot holds many timers is moved down over several calls.
+template<typename T>
+class TimingWheel{
+private:
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr int SLOTS = 1 << LEVEL_BITS;
+    static constexpr int LEVELS = 4;
+    // Timers further out are parked on the top level and re-placed when it cascades
+    static constexpr uint64_t MAX_DELTA = (uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+
+    struct Timer{
+        T key;
+        uint64_t tick;
+        int level = 0;
+        int slot = 0;
+    };
+
+    // An upper-level slot whose timers are moving down at nextTick. Only the first `remaining`
+    // timers were there when the cascade began; later ones (appended) are already placed.
+    struct Cascade{
+        int level;
+        int slot;
+        size_t remaining;
+    };
+
+    list<Timer> slots[LEVELS][SLOTS];
+    list<Timer> staging;
+    size_t levelCount[LEVELS] = {};
+    vector<Cascade> cascades;   // top level last, so it moves first
+    time_point<steady_clock> origin;
+    nanoseconds resolution;
+    uint64_t nextTick = 0;      // every tick before this one has been fully processed
+    bool cascaded = false;      // nextTick's cascade already ran and its bucket is being drained
+
+    uint64_t floorTick(time_point<steady_clock> when) const{
+        if( when <= origin ) return 0;
+        return (when - origin) / resolution;
+    }
+
+    uint64_t ceilTick(time_point<steady_clock> when) const{
+        if( when <= origin ) return 0;
+        return ((when - origin) + resolution - nanoseconds(1)) / resolution;
+    }
+
+public:
+    using Handle = typename list<Timer>::iterator;
+
+private:
+    void place(list<Timer>& from, Handle timer){
+        uint64_t delta = min(max(timer->tick, nextTick) - nextTick, MAX_DELTA);
+        int level = 0;
+        while( level < LEVELS - 1 && delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1))) ){
+            level++;
+        }
+        timer->level = level;
+        timer->slot = ((nextTick + delta) >> (LEVEL_BITS * level)) & (SLOTS - 1);
+        list<Timer>& bucket = slots[level][timer->slot];
+        bucket.splice(bucket.end(), from, timer);
+        levelCount[level]++;
+    }
+
+    // Moves up to `budget` timers of the pending cascades down; returns how many moved
+    size_t cascade(size_t budget){
+        size_t moved = 0;
+        while( !cascades.empty() ){
+            Cascade& pending = cascades.back();
+            list<Timer>& bucket = slots[pending.level][pending.slot];
+            while( pending.remaining > 0 && !bucket.empty() ){
+                if( moved == budget ){
+                    return moved;
+                }
+                levelCount[pending.level]--;
+                place(bucket, bucket.begin());
+                pending.remaining--;
+                moved++;
+            }
+            cascades.pop_back();
+        }
+        return moved;
+    }
+
+public:
+    TimingWheel(nanoseconds _resolution) : origin(steady_clock::now()), resolution(_resolution){
+        if( resolution <= nanoseconds::zero() ){
+            throw invalid_argument("Timing wheel resolution must be positive");
+        }
+    }
+
+    Handle schedule(const T& key, time_point<steady_clock> when){
+        staging.push_back(Timer{key, ceilTick(when)});
+        Handle timer = prev(staging.end());
+        place(staging, timer);
+        return timer;
+    }
+
+    void reschedule(Handle timer, time_point<steady_clock> when){
+        list<Timer>& bucket = slots[timer->level][timer->slot];
+        levelCount[timer->level]--;
+        timer->tick = ceilTick(when);
+        place(bucket, timer);
+    }
+
+    void cancel(Handle timer){
+        levelCount[timer->level]--;
+        slots[timer->level][timer->slot].erase(timer);
+    }
+
+    size_t size() const{
+        return accumulate(begin(levelCount), end(levelCount), size_t(0));
+    }
+
+    // Fires or cascades at most `budget` timers in total that are due at `now`, passing each
+    // fired key to onExpire, and returns how many fired. Leftover work resumes on the next call.
+    template<typename F>
+    size_t advance(time_point<steady_clock> now, size_t budget, F&& onExpire){
+        uint64_t nowTick = floorTick(now);
+        size_t fired = 0;
+        size_t work = 0;
+        while( nextTick <= nowTick ){
+            if( size() == 0 ){
+                nextTick = nowTick + 1;
+                cascaded = false;
+                cascades.clear();
+                break;
+            }
+            if( !cascaded ){
+                // With the lowest levels empty, nothing happens before the next boundary where they refill
+                int emptyLevels = 0;
+                while( levelCount[emptyLevels] == 0 ){
+                    emptyLevels++;
+                }
+                uint64_t span = uint64_t(1) << (LEVEL_BITS * emptyLevels);
+                if( emptyLevels > 0 && nextTick % span != 0 ){
+                    nextTick = min((nextTick / span + 1) * span, nowTick + 1);
+                    continue;
+                }
+                for( int level = 1; level < LEVELS; level++ ){
+                    if( nextTick % (uint64_t(1) << (LEVEL_BITS * level)) == 0 ){
+                        int slot = (nextTick >> (LEVEL_BITS * level)) & (SLOTS - 1);
+                        cascades.push_back(Cascade{level, slot, slots[level][slot].size()});
+                    }
+                }
+                cascaded = true;
+            }
+            work += cascade(budget - work);
+            if( !cascades.empty() ){
+                return fired;
+            }
+            list<Timer>& bucket = slots[0][nextTick & (SLOTS - 1)];
+            while( !bucket.empty() ){
+                if( work == budget ){
+                    return fired;
+                }
+                T key = move(bucket.front().key);
+                bucket.pop_front();
+                levelCount[0]--;
+                fired++;
+                work++;
+                onExpire(key);
+            }
+            nextTick++;
+            cascaded = false;
+        }
+        return fired;
+    }
+};
+
+// TTL-enabled Storage
+// Expired entries are reclaimed actively by a timing wheel: every operation except size()
+// reclaims a bounded slice of due entries, and a lookup of an expired key drops it at once.
+// size() counts entries not reclaimed yet, so it may include expired ones while a backlog
+// drains; reclaimExpired() from a background tick keeps that backlog short.
+//
+// Every key may carry its own TTL. In stale-while-revalidate mode a key is fresh until its TTL
+// (the soft TTL) and then served stale for `staleFor` more (the hard TTL). The first stale read
+// starts one asynchronous refresh through the refresher and returns the stale value at once;
+// the refreshed value is applied by whichever operation runs after the refresh completes.
+template<typename T, typename V>
+class TTLHashMapStorage : public IStorage<T, V> {
+public:
+    using Refresher = function<V(const T&)>;
+
+private:
+    struct Entry {
+        V value;
+        milliseconds ttl;
+        time_point<steady_clock> staleAt;   // soft TTL
+        time_point<steady_clock> expiresAt; // hard TTL
+        typename TimingWheel<T>::Handle timer;
+        bool refreshing = false;
+    };
+
+    // Results are handed over from refresh threads and applied on the storage's own thread
+    struct RefreshResults {
+        mutex lock;
+        vector<pair<T, optional<V>>> done;
+    };
+
+    unordered_map<T, Entry, KeyHash<T>, KeyEqual<T>> data;
+    TimingWheel<T> wheel;
+    milliseconds ttl; // Default TTL for all keys
+    milliseconds staleFor; // How long past its TTL a key may be served while it refreshes
+    Refresher refresher;
+    size_t reclaimBudget; // Expired entries reclaimed per operation
+    function<void(const T&)> expirationListener;
+    shared_ptr<RefreshResults> refreshResults = make_shared<RefreshResults>();
+    list<future<void>> refreshes; // destroying a pending future waits for its refresh to finish
+
+    size_t reclaim(time_point<steady_clock> now, size_t budget) {
+        return wheel.advance(now, budget, [this](const T& key) {
+            data.erase(key);
+            if (expirationListener) expirationListener(key);
+        });
+    }
+
+    void store(const T& key, const V& val, milliseconds keyTtl, time_point<steady_clock> now) {
+        auto staleAt = now + keyTtl;
+        auto expiresAt = staleAt + staleFor;
+        auto it = data.find(key);
+        if (it != data.end()) {
+            Entry& entry = it->second;
+            entry.value = val;
+            entry.ttl = keyTtl;
+            entry.staleAt = staleAt;
+            entry.expiresAt = expiresAt;
+            entry.refreshing = false; // a pending refresh must not overwrite this newer value
+            wheel.reschedule(entry.timer, expiresAt);
+            return;
+        }
+        data.emplace(key, Entry{ val, keyTtl, staleAt, expiresAt, wheel.schedule(key, expiresAt) });
+    }
+
+    void applyRefreshes(time_point<steady_clock> now) {
+        if (refreshes.empty()) return;
+        vector<pair<T, optional<V>>> done;
+        {
+            lock_guard<mutex> guard(refreshResults->lock);
+            done.swap(refreshResults->done);
+        }
+        for (auto& [key, val] : done) {
+            auto it = data.find(key);
+            if (it == data.end() || !it->second.refreshing) continue;
+            if (val) {
+                store(key, *val, it->second.ttl, now);
+            } else {
+                it->second.refreshing = false; // failed refresh, the next stale read retries
+            }
+        }
+        refreshes.remove_if([](const future<void>& refresh) {
+            return refresh.wait_for(seconds(0)) == future_status::ready;
+        });
+    }
+
+    // The key's entry if it has not hit its hard TTL, after this operation's reclaim slice.
+    // Never starts a refresh. Key is T or HashedKey<T>.
+    template<typename Key>
+    Entry* liveEntry(const Key& key, time_point<steady_clock> now) {
+        applyRefreshes(now);
+        reclaim(now, reclaimBudget);
+        auto it = data.find(key);
+        if (it == data.end()) return nullptr;
+
+        // The entry may be due but not reclaimed yet if earlier slices ran out of budget
+        Entry& entry = it->second;
+        if (now > entry.expiresAt) {
+            T expired = it->first;
+            wheel.cancel(entry.timer);
+            data.erase(it);
+            if (expirationListener) expirationListener(expired);
+            return nullptr;
+        }
+        return &entry;
+    }
+
+    // Shared by both find() overloads: reads are what start stale-while-revalidate refreshes
+    template<typename Key>
+    V* findLive(const Key& key) {
+        auto now = steady_clock::now();
+        Entry* entry = liveEntry(key, now);
+        if (!entry) return nullptr;
+        if (now > entry->staleAt && refresher && !entry->refreshing) {
+            startRefresh(ownedKey(key), *entry);
+        }
+        return &entry->value;
+    }
+
+    void startRefresh(const T& key, Entry& entry) {
+        entry.refreshing = true;
+        refreshes.push_back(async(launch::async, [refresh = refresher, results = refreshResults, key] {
+            optional<V> val;
+            try {
+                val = refresh(key);
+            } catch (...) {
+            }
+            lock_guard<mutex> guard(results->lock);
+            results->done.emplace_back(key, move(val));
+        }));
+    }
+
+public:
+    // Constructor with TTL
+    TTLHashMapStorage(milliseconds _ttl, milliseconds resolution = milliseconds(1), size_t _reclaimBudget = 16)
+        : wheel(resolution), ttl(_ttl), staleFor(0), reclaimBudget(_reclaimBudget) {}
+
+    // Constructor for stale-while-revalidate mode
+    TTLHashMapStorage(milliseconds _ttl, milliseconds _staleFor, Refresher _refresher, milliseconds resolution = milliseconds(1), size_t _reclaimBudget = 16)
+        : wheel(resolution), ttl(_ttl), staleFor(_staleFor), refresher(move(_refresher)), reclaimBudget(_reclaimBudget) {}
+
+    void add(const T& key, const V& val) override {
+        add(key, val, ttl);
+    }
+
+    void add(const T& key, const V& val, milliseconds keyTtl) override {
+        auto now = steady_clock::now();
+        applyRefreshes(now);
+        reclaim(now, reclaimBudget);
+        store(key, val, keyTtl, now);
+    }
+
+    V get(const T& key) override {
+        V* val = find(key);
+        if (!val) {
+            throw runtime_error("Key not found in TTL HashMap Cache");
+        }
+        return *val;
+    }
+
+    V* find(const T& key) override {
+        return findLive(key);
+    }
+
+    V* find(const HashedKey<T>& key) override {
+        return findLive(key);
+    }
+
+    void remove(const T& key) override {
+        auto now = steady_clock::now();
+        applyRefreshes(now);
+        reclaim(now, reclaimBudget);
+        auto it = data.find(key);
+        if (it != data.end()) {
+            wheel.cancel(it->second.timer);
+            data.erase(it);
+        }
+    }
+
+    // Liveness only: puts and removes call it, and must not start a refresh of a stale key
+    bool exists(const T& key) override {
+        return liveEntry(key, steady_clock::now()) != nullptr;
+    }
+
+    size_t size() const override {
+        return data.size();
+    }
+
+    // Reclaims up to `budget` expired entries; call it from a background tick to keep the backlog short
+    size_t reclaimExpired(size_t budget = SIZE_MAX) {
+        return reclaim(steady_clock::now(), budget);
+    }
+
+    void setExpirationListener(function<void(const T&)> listener) override {
+        expirationListener = move(listener);
+    }
+};
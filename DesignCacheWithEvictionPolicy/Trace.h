@@ -0,0 +1,113 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+
+using namespace std;
+using namespace std::chrono;
+
+// Draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^skew
+class ZipfGenerator{
+private:
+    vector<double> cdf;
+    uniform_real_distribution<double> uniform{0.0, 1.0};
+
+public:
+    ZipfGenerator(size_t n, double skew) : cdf(n){
+        double sum = 0;
+        for( size_t rank = 0; rank < n; rank++ ){
+            sum += 1.0 / pow(rank + 1.0, skew);
+            cdf[rank] = sum;
+        }
+        for( double& c : cdf ){
+            c /= sum;
+        }
+    }
+
+    template<typename Rng>
+    size_t operator()(Rng& rng){
+        return min<size_t>(lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+// Synthetic traces are keyed by rank, so key 0 is the hottest key of a Zipf trace
+vector<uint64_t> zipfTrace(size_t keys, size_t ops, double skew, uint64_t seed = 1){
+    ZipfGenerator zipf(keys, skew);
+    mt19937_64 rng(seed);
+    vector<uint64_t> trace(ops);
+    for( uint64_t& key : trace ){
+        key = zipf(rng);
+    }
+    return trace;
+}
+
+// Every key is requested exactly once
+vector<uint64_t> scanTrace(size_t ops, uint64_t firstKey = 0){
+    vector<uint64_t> trace(ops);
+    iota(trace.begin(), trace.end(), firstKey);
+    return trace;
+}
+
+// Cycles through the same `keys` keys in order
+vector<uint64_t> loopTrace(size_t keys, size_t ops){
+    vector<uint64_t> trace(ops);
+    for( size_t i = 0; i < ops; i++ ){
+        trace[i] = i % max<size_t>(keys, 1);
+    }
+    return trace;
+}
+
+// Ten phases, each a Zipf burst followed by a scan over fresh keys a quarter of its length
+vector<uint64_t> mixedTrace(size_t keys, size_t ops, double skew, uint64_t seed = 1){
+    const size_t phases = 10;
+    size_t phaseOps = ops / phases;
+    size_t scanOps = phaseOps / 5;
+    ZipfGenerator zipf(keys, skew);
+    mt19937_64 rng(seed);
+    vector<uint64_t> trace;
+    trace.reserve(ops);
+    uint64_t nextScanKey = keys;
+    for( size_t phase = 0; phase < phases; phase++ ){
+        for( size_t i = scanOps; i < phaseOps; i++ ){
+            trace.push_back(zipf(rng));
+        }
+        for( size_t i = 0; i < scanOps; i++ ){
+            trace.push_back(nextScanKey++);
+        }
+    }
+    return trace;
+}
+
+// Loads a trace file: ".bin" files hold raw little-endian uint64 keys, anything else is text
+// with one key per line. Non-numeric text keys are hashed.
+vector<uint64_t> loadTrace(const string& path){
+    bool binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+    ifstream in(path, binary ? ios::binary : ios::in);
+    if( !in ){
+        throw runtime_error("Cannot open trace file " + path);
+    }
+    vector<uint64_t> trace;
+    if( binary ){
+        uint64_t key;
+        while( in.read(reinterpret_cast<char*>(&key), sizeof(key)) ){
+            trace.push_back(key);
+        }
+        return trace;
+    }
+    string line;
+    while( getline(in, line) ){
+        if( line.empty() ) continue;
+        uint64_t key;
+        auto [end, error] = from_chars(line.data(), line.data() + line.size(), key);
+        trace.push_back(error == errc() && end == line.data() + line.size() ? key : hash<string>()(line));
+    }
+    return trace;
+}
+
+void saveTrace(const string& path, const vector<uint64_t>& trace){
+    ofstream out(path, ios::binary);
+    out.write(reinterpret_cast<const char*>(trace.data()), trace.size() * sizeof(uint64_t));
+    if( !out ){
+        throw runtime_error("Cannot write trace file " + path);
+    }
+}